@@ -0,0 +1,64 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <mutex>
+
+// 程序启动以来全局operator new被调用的次数, 用来统计每帧的堆分配
+unsigned long heap_allocations();
+
+/**
+ * @brief 线性分配器, 用于每帧的临时数据: 分配只是移动指针, reset()为O(1)
+ * 容量不够时临时向堆申请溢出块, 下次reset()时把容量扩大到这一帧的峰值, 之后的帧不再分配
+ * 不是线程安全的, 只在渲染线程上使用
+ */
+class Arena {
+private:
+	struct Overflow;
+	char *base_;
+	size_t capacity_;
+	size_t offset_;
+	//这一帧一共申请的字节数(包括溢出块)
+	size_t requested_;
+	size_t peak_;
+	Overflow *overflow_;
+	unsigned long allocs_;
+
+public:
+	Arena(size_t capacity);
+	~Arena();
+	void *allocate(size_t bytes, size_t align = 16);
+	template <class T>
+	T *alloc(size_t n) { return static_cast<T *>(allocate(n * sizeof(T), alignof(T) > 16 ? alignof(T) : 16)); }
+	void reset();
+	size_t capacity() const;
+	size_t used() const;
+	size_t peak() const;
+	unsigned long allocs() const;
+};
+
+// 渲染线程每帧使用的arena
+Arena &frame_arena();
+
+/**
+ * @brief 大块缓冲区(图像, 深度缓冲)的缓存池, 释放的缓冲区留着给之后大小合适的申请使用
+ * 线程安全
+ */
+class BufferPool {
+private:
+	static const int SLOTS = 32;
+	void *free_[SLOTS];
+	int nfree_;
+	std::mutex mutex_;
+
+public:
+	BufferPool();
+	~BufferPool();
+	void *acquire(size_t bytes);
+	void release(void *p);
+	void trim();
+};
+
+BufferPool &buffer_pool();
+
+#endif //__ARENA_H__
@@ -0,0 +1,90 @@
+#ifndef __IMAGE_WRITER_H__
+#define __IMAGE_WRITER_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "tgaimage.h"
+
+enum ImageFormat
+{
+	IMAGE_TGA, IMAGE_TGA_RLE, IMAGE_PPM, IMAGE_PAM, IMAGE_QOI
+};
+
+// 根据扩展名(.tga .ppm .pam .qoi)选择格式, 不认识的按rle压缩的tga处理
+ImageFormat format_from_filename(const char *filename);
+
+/**
+ * @brief 把图像编码到一段连续的内存里
+ *
+ * @param flip 为true时输出上下翻转的图像(相当于先调用flip_vertically), 翻转在编码时完成, 不需要额外的一遍
+ * @param strips qoi分段编码时每段的缓冲区, 可以为空
+ * @param parallel qoi的各段是否在线程池上并行编码
+ */
+void encode_image(TGAImage &image, ImageFormat format, bool flip, std::vector<unsigned char> &out,
+                  std::vector<std::vector<unsigned char> > *strips = NULL, bool parallel = true);
+// 一次write把整段数据写进文件
+bool write_file(const char *filename, const unsigned char *data, size_t size);
+
+/**
+ * @brief 后台写图像的线程: submit()只拷贝一份图像就返回, 编码和写文件在后台线程完成
+ * 队列长度固定, 队列满时submit()会等待; 文件名太长时submit()直接返回false
+ * 后台线程不用线程池, qoi也在后台线程上串行编码: 编码慢一些, 但不会和渲染线程抢线程池
+ */
+class ImageWriter {
+public:
+	struct Stats
+	{
+		int files;
+		//写文件失败的个数, 失败的文件不计入files和encoded_bytes
+		int failed;
+		//渲染线程在submit()和flush()里等待的时间, 实际测得的阻塞时间
+		double submit_ms;
+		double flush_ms;
+		//后台线程编码和写文件的时间, 同步写的话这些时间都在渲染线程上
+		double encode_ms;
+		double write_ms;
+		size_t raw_bytes;
+		size_t encoded_bytes;
+
+		Stats() : files(0), failed(0), submit_ms(0), flush_ms(0), encode_ms(0), write_ms(0), raw_bytes(0), encoded_bytes(0) {}
+		double encode_mb_per_s() const { return encode_ms > 0 ? raw_bytes / encode_ms / 1e3 : 0; }
+		double blocked_ms() const { return submit_ms + flush_ms; }
+	};
+
+private:
+	static const int QUEUE = 4;
+	static const int MAX_FILENAME = 1024;
+	struct Job
+	{
+		TGAImage image;
+		char filename[MAX_FILENAME];
+		ImageFormat format;
+		bool flip;
+	};
+	Job jobs_[QUEUE];
+	int head_;
+	int count_;
+	bool stop_;
+	Stats stats_;
+	std::vector<unsigned char> buffer_;
+	std::vector<std::vector<unsigned char> > strips_;
+	std::mutex mutex_;
+	std::condition_variable not_empty_;
+	std::condition_variable not_full_;
+	std::thread thread_;
+
+	void loop();
+
+public:
+	ImageWriter();
+	~ImageWriter();
+	ImageWriter(const ImageWriter &) = delete;
+	ImageWriter &operator=(const ImageWriter &) = delete;
+	bool submit(TGAImage &image, const char *filename, ImageFormat format, bool flip);
+	void flush();
+	Stats stats();
+};
+
+#endif //__IMAGE_WRITER_H__
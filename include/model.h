@@ -8,10 +8,16 @@ class Model {
 private:
 	//顶点
 	std::vector<Vec3f> verts_;
-	//面
-	std::vector<std::vector<Vec2i> > faces_;
+	//面, 都是三角形, 每3个一组连续存放, 每个顶点存 (顶点, 纹理, 法线) 的下标
+	std::vector<Vec3i> faces_;
 	//纹理
 	std::vector<Vec3f> textures_;
+	//法线, 按分量分开存放(SoA)
+	std::vector<float> norms_x_;
+	std::vector<float> norms_y_;
+	std::vector<float> norms_z_;
+
+	void compute_normals();
 
 public:
 	Model(const char *filename);
@@ -19,9 +25,18 @@ public:
 	int nverts();
 	int nfaces();
 	int ntextures();
+	int nnorms();
 	Vec3f vert(int i);
-	std::vector<Vec2i> face(int idx);
+	Vec3f vert(int iface, int nthvert);
+	const Vec3i *face(int idx);
 	Vec3f texture(int i);
+	Vec3f texture(int iface, int nthvert);
+	Vec3f norm(int i);
+	Vec3f norm(int iface, int nthvert);
+	void subdivide(int levels);
+	const float *norms_x() const;
+	const float *norms_y() const;
+	const float *norms_z() const;
 };
 
 #endif //__MODEL_H__
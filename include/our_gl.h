@@ -0,0 +1,244 @@
+#ifndef __OUR_GL_H__
+#define __OUR_GL_H__
+
+#include <algorithm>
+#include <cmath>
+#include "geometry.h"
+#include "model.h"
+#include "tgaimage.h"
+
+// 一次交给片元着色器的最大像素数, 一条扫描线超过这个长度会分段
+const int SPAN = 64;
+
+/**
+ * @brief 着色器在编译期作为模板参数传给光栅化器, 不需要虚函数, 每种着色器都会生成自己的内层循环
+ * 一个着色器需要提供:
+ *
+ *   enum { NVARYING = k };   // 需要插值的属性个数, 只有这些属性会被插值
+ *   // 顶点着色: 返回屏幕坐标(x, y, z), 把k个属性写进varying, rhw为透视投影的1/w, 用于透视校正插值
+ *   Vec3f vertex(int iface, int nthvert, float *varying, float &rhw) const;
+ *   // 片元着色: 一段扫描线上的n个像素, varying[k][p]是第p个像素的第k个属性(按分量分开存放, 方便向量化)
+ *   void fragment(const float (*varying)[SPAN], int n, TGAColor *color) const;
+ *
+ * 分块渲染时vertex()和fragment()会在不同的线程上同时调用, 所以每个面的数据要放在varying里, 不能存在着色器里
+ */
+
+/**
+ * @brief 求点p关于三角形的重心坐标, 只用到顶点的x和y
+ */
+inline Vec3f Barycentric(const Vec3f *vertex, Vec2f p)
+{
+    Vec3f res;
+    Vec2f v[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        v[i].x = vertex[i].x;
+        v[i].y = vertex[i].y;
+    }
+    res.raw[0] = ((v[1] - p) ^ (v[2] - p)) / ((v[1] - v[0]) ^ (v[2] - v[0]));
+    res.raw[1] = ((v[2] - p) ^ (v[0] - p)) / ((v[2] - v[1]) ^ (v[0] - v[1]));
+    res.raw[2] = 1 - res.x - res.y;
+    return res;
+}
+
+/**
+ * @brief 三角形的覆盖范围和平面方程
+ * 顶点先对齐到1/256像素的定点数, 边函数用64位整数精确计算: 共享一条边的两个三角形在这条边上的值正好相反,
+ * 恰好落在边上的像素按top-left规则只归其中一个, 所以相邻三角形之间既没有缝也不会重复画.
+ * 每一行被覆盖的像素是连续的一段, 直接解出这一段的起止, 内层循环不再判断边函数
+ */
+class TriangleSetup
+{
+public:
+    // 顶点坐标的小数位数
+    enum { SUBPIXEL_BITS = 8 };
+    // 顶点在平面方程里的值: q(ox + dx, oy + dy) = v0 + dy * this->dy + dx * this->dx
+    struct Plane
+    {
+        float v0, dx, dy;
+    };
+
+    // 对齐后的顶点坐标, z不变
+    Vec3f v[3];
+    // 裁剪后的包围盒(包含边界)
+    int xmin, ymin, xmax, ymax;
+    // 平面方程的原点, 取三角形自己的包围盒角点, 不随裁剪矩形变化, 分块渲染和整屏渲染结果逐位相同
+    int ox, oy;
+
+    /**
+     * @brief 三角形是背面(屏幕上顺时针)或退化, 坐标超出范围, 或者和裁剪矩形(x0, y0, x1, y1, 包含边界)不相交时返回false
+     */
+    bool setup(const Vec3f *pts, int x0, int y0, int x1, int y1);
+    /**
+     * @brief setup()的前一半: 只对齐顶点, 判断面积和算出包围盒, 不算边函数和平面方程, 返回值和setup()相同
+     * 分块时用它决定三角形画不画和落在哪些块里, 和光栅化时的判断完全一致
+     */
+    bool bounds(const Vec3f *pts, int x0, int y0, int x1, int y1);
+    /**
+     * @brief 第y行被覆盖的像素[x0, x1], 这一行没有像素被覆盖时返回false
+     */
+    bool span(int y, int &x0, int &x1) const;
+    /**
+     * @brief 顶点上的量q0, q1, q2在三角形内的平面方程
+     */
+    Plane plane(float q0, float q1, float q2) const
+    {
+        Plane p;
+        p.v0 = (l_[0] * q0 + l_[1] * q1 + l_[2] * q2) * inv_area_;
+        p.dx = (l_dx_[0] * q0 + l_dx_[1] * q1 + l_dx_[2] * q2) * inv_area_;
+        p.dy = (l_dy_[0] * q0 + l_dy_[1] * q1 + l_dy_[2] * q2) * inv_area_;
+        return p;
+    }
+
+private:
+    // 对齐后的顶点坐标(定点数)和两倍面积
+    long long X_[3], Y_[3], area_;
+    // 定点数的边函数: 第k条边(顶点k的对边)在像素(x, y)处的值是 c_[k] + x * step_x_[k] + y * step_y_[k], 已经加上了fill rule的偏移
+    long long c_[3], step_x_[3], step_y_[3];
+    // 浮点的边函数在(ox, oy)处的值和偏导, 只用来算平面方程
+    float l_[3], l_dx_[3], l_dy_[3], inv_area_;
+};
+
+/**
+ * @brief 只写深度的光栅化, 没有颜色和纹理, 用于shadow map和z-prepass
+ * 覆盖范围和triangle()完全相同, 深度是x的线性函数, 内层循环没有分支
+ *
+ * @param pts 三个顶点的屏幕坐标, z越大越近
+ * @param zbuffer 大小为width乘height, 按行存放
+ * @param cull_back 是否丢弃背面(屏幕上顺时针)的三角形
+ */
+void depth_triangle(const Vec3f *pts, float *zbuffer, int width, int height, bool cull_back);
+
+/**
+ * @brief 只画模型的深度
+ *
+ * @param project 把模型空间的顶点变换到屏幕坐标, Vec3f project(Vec3f)
+ */
+template <class Project>
+void draw_depth(Model *model, Project project, float *zbuffer, int width, int height, bool cull_back)
+{
+    for (int i = 0; i < model->nfaces(); i++)
+    {
+        Vec3f pts[3];
+        for (int j = 0; j < 3; j++)
+        {
+            pts[j] = project(model->vert(i, j));
+        }
+        depth_triangle(pts, zbuffer, width, height, cull_back);
+    }
+}
+
+/**
+ * @brief 带z-buffer的三角形光栅化, 背面(屏幕上顺时针)的三角形直接丢弃
+ * 建立三角形时(TriangleSetup)解出每行被覆盖的像素, 算出深度, 1/w 以及每个属性乘以 1/w 的平面方程(对x和y的偏导),
+ * 逐像素只需要沿x方向增加, 不用每个像素算重心坐标(两次除法).
+ * 深度z是屏幕空间的线性量, 直接插值, 测试和写入的是同一个值; 属性做透视校正:
+ * 插值 a/w 和 1/w, 再相除. 除法在交给片元着色器之前对整段像素一起做
+ *
+ * @param screen_coords 三个顶点的屏幕坐标
+ * @param rhw 三个顶点的 1/w
+ * @param varying 三个顶点的属性, varying[i][k]是第i个顶点的第k个属性
+ * @param zbuffer 大小为image的宽乘高, 按行存放
+ * @param zbias 深度测试的容差, zbuffer已经由z-prepass写好时用一个小的正数, 否则为0
+ * @param clip 不为空时只画这个矩形(x0, y0, x1, y1, 包含边界)里的像素, 用于分块渲染
+ */
+template <class Shader>
+void triangle(const Vec3f *screen_coords, const float *rhw, const float (*varying)[Shader::NVARYING > 0 ? Shader::NVARYING : 1], const Shader &shader, TGAImage &image, float *zbuffer, float zbias = 0, const int *clip = NULL)
+{
+    const int NV = Shader::NVARYING;
+    const int width = image.get_width();
+    const int height = image.get_height();
+    TriangleSetup tri;
+    if (!(clip ? tri.setup(screen_coords, clip[0], clip[1], clip[2], clip[3])
+               : tri.setup(screen_coords, 0, 0, width - 1, height - 1)))
+    {
+        return;
+    }
+    typedef TriangleSetup::Plane Plane;
+    const Plane z_plane = tri.plane(tri.v[0].z, tri.v[1].z, tri.v[2].z);
+    const Plane w_plane = tri.plane(rhw[0], rhw[1], rhw[2]);
+    Plane attr[NV > 0 ? NV : 1];
+    for (int k = 0; k < NV; ++k)
+    {
+        attr[k] = tri.plane(varying[0][k] * rhw[0], varying[1][k] * rhw[1], varying[2][k] * rhw[2]);
+    }
+
+    int span_x[SPAN];
+    float span_rhw[SPAN];
+    float span_varying[NV > 0 ? NV : 1][SPAN];
+    TGAColor colors[SPAN];
+    auto flush = [&](int y, int n) {
+        float inv_w[SPAN];
+        for (int p = 0; p < n; ++p)
+        {
+            inv_w[p] = 1.f / span_rhw[p];
+        }
+        for (int k = 0; k < NV; ++k)
+        {
+            for (int p = 0; p < n; ++p)
+            {
+                span_varying[k][p] *= inv_w[p];
+            }
+        }
+        shader.fragment(span_varying, n, colors);
+        for (int p = 0; p < n; ++p)
+        {
+            image.set(span_x[p], y, colors[p]);
+        }
+    };
+    for (int j = tri.ymin; j <= tri.ymax; ++j)
+    {
+        int xl, xr;
+        if (!tri.span(j, xl, xr))
+            continue;
+        const float dy = j - tri.oy;
+        const float z_row = z_plane.v0 + dy * z_plane.dy;
+        const float w_row = w_plane.v0 + dy * w_plane.dy;
+        float *zrow = zbuffer + j * width;
+        int n = 0;
+        for (int i = xl; i <= xr; ++i)
+        {
+            const float dx = i - tri.ox;
+            float z_new = z_row + dx * z_plane.dx;
+            if (z_new + zbias <= zrow[i])
+                continue;
+            zrow[i] = z_new;
+            span_x[n] = i;
+            span_rhw[n] = w_row + dx * w_plane.dx;
+            for (int k = 0; k < NV; ++k)
+            {
+                span_varying[k][n] = attr[k].v0 + dy * attr[k].dy + dx * attr[k].dx;
+            }
+            if (++n == SPAN)
+            {
+                flush(j, n);
+                n = 0;
+            }
+        }
+        if (n > 0)
+        {
+            flush(j, n);
+        }
+    }
+}
+
+/**
+ * @brief 用给定的着色器画出模型的所有面
+ */
+template <class Shader>
+void draw(Model *model, const Shader &shader, TGAImage &image, float *zbuffer, float zbias = 0)
+{
+    for (int i = 0; i < model->nfaces(); i++)
+    {
+        Vec3f screen_coords[3];
+        float rhw[3];
+        float varying[3][Shader::NVARYING > 0 ? Shader::NVARYING : 1];
+        for (int j = 0; j < 3; j++)
+        {
+            screen_coords[j] = shader.vertex(i, j, varying[j], rhw[j]);
+        }
+        triangle(screen_coords, rhw, varying, shader, image, zbuffer, zbias);
+    }
+}
+
+#endif //__OUR_GL_H__
@@ -0,0 +1,84 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief 可用的工作线程数, 至少为1; 可以用环境变量 TINYRENDERER_THREADS 指定
+ */
+int worker_count();
+
+/**
+ * @brief 常驻的线程池, 避免每次parallel_for都创建线程(创建线程会分配堆内存)
+ * 同一时间只执行一批任务; 已经在执行时(比如嵌套调用)新的一批在调用线程上串行执行
+ */
+class ThreadPool {
+private:
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::mutex run_mutex_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	void (*fn_)(void *, int);
+	void *ctx_;
+	int ntasks_;
+	std::atomic<int> next_;
+	int active_;
+	unsigned long generation_;
+	bool stop_;
+
+	void worker_loop();
+	void work();
+
+public:
+	ThreadPool(int nthreads);
+	~ThreadPool();
+	int size() const;
+	void run(int ntasks, void (*fn)(void *, int), void *ctx);
+	static ThreadPool &instance();
+};
+
+template <class F>
+struct ParallelForTask
+{
+	F *fn;
+	int begin;
+	int n;
+	int nthreads;
+
+	static void call(void *ctx, int t)
+	{
+		ParallelForTask *task = (ParallelForTask *)ctx;
+		int b = task->begin + (int)((long long)task->n * t / task->nthreads);
+		int e = task->begin + (int)((long long)task->n * (t + 1) / task->nthreads);
+		(*task->fn)(b, e, t);
+	}
+};
+
+/**
+ * @brief 把[begin, end)均分成若干段, 每段交给一个线程执行 fn(seg_begin, seg_end, thread_id)
+ * 每个线程至少分到 grain 个元素, 工作量太小时直接在当前线程执行
+ */
+template <class F>
+void parallel_for(int begin, int end, F fn, int grain = 1024)
+{
+	int n = end - begin;
+	if (n <= 0)
+		return;
+	ThreadPool &pool = ThreadPool::instance();
+	int nthreads = std::max(1, std::min(pool.size(), n / std::max(1, grain)));
+	if (nthreads == 1)
+	{
+		fn(begin, end, 0);
+		return;
+	}
+	ParallelForTask<F> task = {&fn, begin, n, nthreads};
+	pool.run(nthreads, ParallelForTask<F>::call, &task);
+}
+
+#endif //__PARALLEL_H__
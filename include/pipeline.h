@@ -0,0 +1,306 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "our_gl.h"
+#include "parallel.h"
+#include "timer.h"
+
+/**
+ * @brief sort-middle分块渲染: 几何线程按批处理面(顶点着色, 背面剔除, 分到屏幕上的块), 光栅线程同时按块光栅化
+ *
+ * 每一批的结果放在一个槽里, 槽组成一个环, 槽里按块存放三角形的编号. 每个块依次消费第0, 1, 2...批,
+ * 所以同一个块里三角形的顺序和串行渲染相同, 输出是确定的(和draw()逐像素一致).
+ * 槽被所有块消费完之后才会被之后的批使用, 内存占用固定, 几何和光栅可以重叠执行.
+ * 槽和块的状态都用原子变量同步, 没有锁. 光栅线程优先处理自己那一段的块, 没有活时去别人那一段里取(work stealing).
+ * 线程来自ThreadPool, 不在每帧创建. 每个线程在自己的阶段没有活(槽满了或者没有新的批)时去做另一个阶段的活,
+ * 所以线程数少于geometry_threads + raster_threads(包括线程池退化成串行)时也不会卡住.
+ */
+class TilePipeline {
+public:
+	struct Config
+	{
+		//块的大小(像素)
+		int tile;
+		//每批的面数
+		int batch;
+		//环里槽的个数
+		int slots;
+		int geometry_threads;
+		int raster_threads;
+
+		Config() : tile(32), batch(1024), slots(8),
+				   geometry_threads(std::max(1, worker_count() / 2)),
+				   raster_threads(std::max(1, worker_count() - worker_count() / 2)) {}
+	};
+
+	struct Stats
+	{
+		double total_ms;
+		//几何线程和光栅线程实际工作的时间之和
+		double geometry_ms;
+		double raster_ms;
+		//相对于开始的时间: 第一次光栅化开始, 最后一批几何处理结束
+		double first_raster_ms;
+		double last_geometry_ms;
+		long triangles;
+		long bin_entries;
+		//光栅线程处理别人那一段的块的次数
+		long steals;
+
+		Stats() : total_ms(0), geometry_ms(0), raster_ms(0), first_raster_ms(0), last_geometry_ms(0), triangles(0), bin_entries(0), steals(0) {}
+		//几何和光栅同时进行的时间
+		double overlap_ms() const { return std::max(0., last_geometry_ms - first_raster_ms); }
+	};
+
+private:
+	Config config_;
+	Stats stats_;
+	//每个线程的统计, 常驻, 避免每帧分配
+	std::vector<Stats> thread_stats_;
+	int ntiles_;
+	//每个槽: 三角形数据, 每个三角形覆盖的块的范围, 每个块的起始位置, 按块排列的三角形编号
+	std::vector<std::vector<float> > tris_;
+	std::vector<std::vector<int> > ranges_;
+	std::vector<std::vector<int> > offsets_;
+	std::vector<std::vector<int> > entries_;
+	std::unique_ptr<std::atomic<int>[]> slot_batch_;
+	std::unique_ptr<std::atomic<int>[]> slot_consumed_;
+	std::unique_ptr<std::atomic<int>[]> tile_next_;
+	std::unique_ptr<std::atomic<int>[]> tile_busy_;
+
+	void resize(int ntiles)
+	{
+		if (ntiles == ntiles_)
+			return;
+		ntiles_ = ntiles;
+		tile_next_.reset(new std::atomic<int>[ntiles]);
+		tile_busy_.reset(new std::atomic<int>[ntiles]);
+		for (auto &o : offsets_)
+			o.assign(ntiles + 1, 0);
+	}
+
+public:
+	TilePipeline(const Config &config = Config()) : config_(config), ntiles_(0)
+	{
+		config_.slots = std::max(1, config_.slots);
+		config_.batch = std::max(1, config_.batch);
+		config_.tile = std::max(8, config_.tile);
+		tris_.resize(config_.slots);
+		ranges_.resize(config_.slots);
+		offsets_.resize(config_.slots);
+		entries_.resize(config_.slots);
+		slot_batch_.reset(new std::atomic<int>[config_.slots]);
+		slot_consumed_.reset(new std::atomic<int>[config_.slots]);
+		config_.geometry_threads = std::max(1, config_.geometry_threads);
+		config_.raster_threads = std::max(1, config_.raster_threads);
+		thread_stats_.resize(config_.geometry_threads + config_.raster_threads);
+	}
+
+	const Config &config() const { return config_; }
+	const Stats &stats() const { return stats_; }
+
+	template <class Shader>
+	void draw(Model *model, const Shader &shader, TGAImage &image, float *zbuffer, float zbias = 0);
+};
+
+/**
+ * @brief 用分块流水线画出模型, 结果和draw(model, shader, image, zbuffer, zbias)相同
+ */
+template <class Shader>
+void TilePipeline::draw(Model *model, const Shader &shader, TGAImage &image, float *zbuffer, float zbias)
+{
+	const int NV = Shader::NVARYING > 0 ? Shader::NVARYING : 1;
+	// 每个三角形: 三个顶点的屏幕坐标, 三个1/w, 三组属性
+	const int stride = 12 + 3 * NV;
+	const int width = image.get_width(), height = image.get_height();
+	const int tile = config_.tile, S = config_.slots, batch = config_.batch;
+	const int tiles_x = (width + tile - 1) / tile, tiles_y = (height + tile - 1) / tile;
+	const int ntiles = tiles_x * tiles_y;
+	const int nfaces = model->nfaces();
+	const int nbatches = (nfaces + batch - 1) / batch;
+	stats_ = Stats();
+	if (nbatches == 0)
+		return;
+	resize(ntiles);
+	for (int s = 0; s < S; ++s)
+	{
+		// 槽s第一次给第s批用, 相当于"第s-S批"已经被所有块消费完
+		slot_batch_[s].store(s - S);
+		slot_consumed_[s].store(ntiles);
+		tris_[s].resize((size_t)batch * stride);
+		ranges_[s].resize(4 * batch);
+	}
+	for (int t = 0; t < ntiles; ++t)
+	{
+		tile_next_[t].store(0);
+		tile_busy_[t].store(0);
+	}
+	std::atomic<int> next_batch(0);
+	std::atomic<int> tiles_done(0);
+	const int G = config_.geometry_threads, R = config_.raster_threads;
+	std::fill(thread_stats_.begin(), thread_stats_.end(), Stats());
+	Timer clock;
+
+	// 槽空出来时领取下一批并分块, 没有可以做的批时返回false
+	auto geometry = [&](Stats &st) {
+		int b = next_batch.load(std::memory_order_relaxed);
+		if (b >= nbatches)
+			return false;
+		int s = b % S;
+		if (slot_batch_[s].load(std::memory_order_acquire) != b - S ||
+			slot_consumed_[s].load(std::memory_order_acquire) != ntiles)
+			return false;
+		if (!next_batch.compare_exchange_strong(b, b + 1, std::memory_order_relaxed))
+			return true;
+		double start = clock.elapsed_ms();
+		float *tris = tris_[s].data();
+		int *ranges = ranges_[s].data();
+		int *offsets = offsets_[s].data();
+		std::fill(offsets, offsets + ntiles + 1, 0);
+		int ntris = 0;
+		for (int f = b * batch, fend = std::min(nfaces, (b + 1) * batch); f < fend; ++f)
+		{
+			float *tri = tris + (size_t)ntris * stride;
+			Vec3f sc[3];
+			for (int j = 0; j < 3; ++j)
+			{
+				sc[j] = shader.vertex(f, j, tri + 12 + j * NV, tri[9 + j]);
+			}
+			// 剔除和包围盒用triangle()里同样的定点数判断, 串行画的三角形这里一个也不会丢
+			TriangleSetup bounds;
+			if (!bounds.bounds(sc, 0, 0, width - 1, height - 1))
+				continue;
+			for (int j = 0; j < 3; ++j)
+			{
+				tri[3 * j] = sc[j].x;
+				tri[3 * j + 1] = sc[j].y;
+				tri[3 * j + 2] = sc[j].z;
+			}
+			int *r = ranges + 4 * ntris;
+			r[0] = bounds.xmin / tile;
+			r[1] = bounds.ymin / tile;
+			r[2] = bounds.xmax / tile;
+			r[3] = bounds.ymax / tile;
+			for (int ty = r[1]; ty <= r[3]; ++ty)
+				for (int tx = r[0]; tx <= r[2]; ++tx)
+					offsets[ty * tiles_x + tx + 1]++;
+			ntris++;
+		}
+		for (int t = 0; t < ntiles; ++t)
+			offsets[t + 1] += offsets[t];
+		std::vector<int> &entries = entries_[s];
+		if ((int)entries.size() < offsets[ntiles] + ntiles)
+			entries.resize(offsets[ntiles] + ntiles);
+		// 末尾ntiles个位置当作每个块的写指针
+		int *cursor = entries.data() + offsets[ntiles];
+		std::copy(offsets, offsets + ntiles, cursor);
+		for (int i = 0; i < ntris; ++i)
+		{
+			const int *r = ranges + 4 * i;
+			for (int ty = r[1]; ty <= r[3]; ++ty)
+				for (int tx = r[0]; tx <= r[2]; ++tx)
+					entries[cursor[ty * tiles_x + tx]++] = i;
+		}
+		st.triangles += ntris;
+		st.bin_entries += offsets[ntiles];
+		slot_consumed_[s].store(0, std::memory_order_relaxed);
+		slot_batch_[s].store(b, std::memory_order_release);
+		double end = clock.elapsed_ms();
+		st.geometry_ms += end - start;
+		st.last_geometry_ms = std::max(st.last_geometry_ms, end);
+		return true;
+	};
+
+	// 扫一遍所有的块, 光栅化已经分好块的批, 从第home个光栅线程自己的那一段开始; 没有做任何事时返回false
+	auto raster = [&](Stats &st, int home) {
+		int home_begin = (long long)ntiles * home / R, home_end = (long long)ntiles * (home + 1) / R;
+		bool progress = false;
+		for (int k = 0; k < ntiles; ++k)
+		{
+			int t = (home_begin + k) % ntiles;
+			if (tile_next_[t].load(std::memory_order_relaxed) >= nbatches)
+				continue;
+			int expected = 0;
+			if (!tile_busy_[t].compare_exchange_strong(expected, 1, std::memory_order_acquire))
+				continue;
+			int b = tile_next_[t].load(std::memory_order_relaxed);
+			if (b >= nbatches)
+			{
+				// 在拿到之前被别的线程做完了
+				tile_busy_[t].store(0, std::memory_order_release);
+				continue;
+			}
+			int clip[4] = {(t % tiles_x) * tile, (t / tiles_x) * tile,
+						   std::min(width, (t % tiles_x + 1) * tile) - 1, std::min(height, (t / tiles_x + 1) * tile) - 1};
+			for (; b < nbatches; ++b)
+			{
+				int s = b % S;
+				if (slot_batch_[s].load(std::memory_order_acquire) != b)
+					break;
+				double start = clock.elapsed_ms();
+				const float *tris = tris_[s].data();
+				const int *offsets = offsets_[s].data();
+				const int *entries = entries_[s].data();
+				for (int e = offsets[t]; e < offsets[t + 1]; ++e)
+				{
+					const float *tri = tris + (size_t)entries[e] * stride;
+					Vec3f sc[3] = {Vec3f(tri[0], tri[1], tri[2]), Vec3f(tri[3], tri[4], tri[5]), Vec3f(tri[6], tri[7], tri[8])};
+					triangle(sc, tri + 9, (const float(*)[NV])(tri + 12), shader, image, zbuffer, zbias, clip);
+				}
+				// 槽被所有块消费完之后几何线程会马上重写它, fetch_add之后不能再读槽里的数据
+				bool had_work = offsets[t + 1] > offsets[t];
+				slot_consumed_[s].fetch_add(1, std::memory_order_release);
+				double end = clock.elapsed_ms();
+				if (had_work)
+					st.first_raster_ms = std::min(st.first_raster_ms, start);
+				st.raster_ms += end - start;
+				progress = true;
+				if (t < home_begin || t >= home_end)
+					st.steals++;
+			}
+			tile_next_[t].store(b, std::memory_order_relaxed);
+			if (b == nbatches)
+				tiles_done.fetch_add(1, std::memory_order_release);
+			tile_busy_[t].store(0, std::memory_order_release);
+		}
+		return progress;
+	};
+
+	// 前G个任务优先做几何, 其余优先光栅化, 自己的阶段没有活时做另一个阶段
+	auto worker = [&](int id) {
+		Stats &st = thread_stats_[id];
+		st.first_raster_ms = 1e30;
+		int home = id < G ? id % R : id - G;
+		while (tiles_done.load(std::memory_order_acquire) < ntiles)
+		{
+			bool progress = id < G ? geometry(st) || raster(st, home) : raster(st, home) || geometry(st);
+			// 剩下的活都在别的线程手里
+			if (!progress)
+				std::this_thread::yield();
+		}
+	};
+	ThreadPool::instance().run(G + R, [](void *ctx, int t) { (*(decltype(worker) *)ctx)(t); }, &worker);
+
+	stats_.total_ms = clock.elapsed_ms();
+	stats_.first_raster_ms = 1e30;
+	for (const Stats &st : thread_stats_)
+	{
+		stats_.geometry_ms += st.geometry_ms;
+		stats_.raster_ms += st.raster_ms;
+		stats_.last_geometry_ms = std::max(stats_.last_geometry_ms, st.last_geometry_ms);
+		if (st.raster_ms > 0 || st.steals > 0)
+			stats_.first_raster_ms = std::min(stats_.first_raster_ms, st.first_raster_ms);
+		stats_.triangles += st.triangles;
+		stats_.bin_entries += st.bin_entries;
+		stats_.steals += st.steals;
+	}
+	if (stats_.first_raster_ms > stats_.total_ms)
+		stats_.first_raster_ms = stats_.total_ms;
+}
+
+#endif //__PIPELINE_H__
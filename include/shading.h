@@ -0,0 +1,15 @@
+#ifndef __SHADING_H__
+#define __SHADING_H__
+
+#include "geometry.h"
+
+// 着色方式: 面法线 / 顶点光照插值 / 逐像素法线插值
+enum ShadeMode
+{
+	FLAT, GOURAUD, PHONG
+};
+
+// out[k] = max(0, dot(normalize(n[k]), light)), 法线按分量分开存放(SoA), light需已归一化
+void lambert_batch(const float *nx, const float *ny, const float *nz, const Vec3f &light, float *out, int n);
+
+#endif //__SHADING_H__
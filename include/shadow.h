@@ -0,0 +1,33 @@
+#ifndef __SHADOW_H__
+#define __SHADOW_H__
+
+#include "geometry.h"
+#include "model.h"
+
+/**
+ * @brief 平行光的shadow map: 从光源方向做正交投影, 只画深度
+ * 主渲染时用PCF(周围若干个texel的比较结果取平均)查询某点被照亮的比例
+ */
+class ShadowMap {
+private:
+	int size_;
+	//从buffer_pool()取得
+	float *depth_;
+	//光源坐标系, ez_指向光源
+	Vec3f ex_, ey_, ez_;
+	//光源坐标系到像素坐标的映射
+	float x0_, y0_, scale_;
+
+public:
+	ShadowMap(int size);
+	~ShadowMap();
+	ShadowMap(const ShadowMap &) = delete;
+	ShadowMap &operator=(const ShadowMap &) = delete;
+	void render(Model *model, Vec3f light_dir);
+	Vec3f project(const Vec3f &p) const;
+	float lit(const Vec3f &p, int radius, float bias) const;
+	int size() const;
+	const float *depth() const;
+};
+
+#endif //__SHADOW_H__
@@ -0,0 +1,42 @@
+#ifndef __SSAO_H__
+#define __SSAO_H__
+
+#include "tgaimage.h"
+
+struct SSAOParams
+{
+	//每个像素搜索的方向数
+	int samples;
+	//每个方向上的采样步数
+	int steps;
+	//搜索半径(像素)
+	float radius;
+	//深度乘以这个系数换算成像素单位
+	float depth_scale;
+	//深度不大于它的像素是背景, 不计算遮蔽
+	float background;
+	//可分离模糊的半径, 0为不模糊
+	int blur_radius;
+	//分块大小(像素)
+	int tile;
+
+	SSAOParams() : samples(8), steps(6), radius(24), depth_scale(1), background(-1e30f), blur_radius(2), tile(32) {}
+};
+
+//每个阶段的耗时(毫秒)
+struct SSAOTimings
+{
+	double ao_ms;
+	double blur_ms;
+	double apply_ms;
+
+	SSAOTimings() : ao_ms(0), blur_ms(0), apply_ms(0) {}
+	double total_ms() const { return ao_ms + blur_ms + apply_ms; }
+};
+
+// 根据深度计算环境光遮蔽, ao大小为width*height, 1为没有遮蔽; 临时内存来自frame_arena()
+void ssao(const float *zbuffer, int width, int height, const SSAOParams &params, float *ao, SSAOTimings *timings = NULL);
+// 把ao乘到image的颜色上, image和zbuffer的行需要对应(在flip_vertically之前调用)
+void apply_ao(TGAImage &image, const float *ao, SSAOTimings *timings = NULL);
+
+#endif //__SSAO_H__
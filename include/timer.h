@@ -0,0 +1,18 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <chrono>
+
+// 简单的计时器, 用于benchmark
+struct Timer
+{
+	std::chrono::steady_clock::time_point start;
+	Timer() : start(std::chrono::steady_clock::now()) {}
+	void reset() { start = std::chrono::steady_clock::now(); }
+	double elapsed_ms() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+#endif //__TIMER_H__
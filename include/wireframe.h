@@ -0,0 +1,68 @@
+#ifndef __WIREFRAME_H__
+#define __WIREFRAME_H__
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "parallel.h"
+#include "tgaimage.h"
+
+/**
+ * @brief 线框渲染: 构造时从模型里取出不重复的边, 每帧变换一次顶点,
+ * 边裁剪到视口(Liang-Barsky)后按行分带, 各带并行光栅化, 直接写image的行
+ * 同一带里的边按原来的顺序画, 结果和线程数无关
+ */
+class Wireframe {
+private:
+	//每条边两个顶点下标, 共享的边只存一次
+	std::vector<int> edges_;
+	//顶点的屏幕坐标
+	std::vector<Vec3f> screen_;
+	//裁剪后的边(x0, y0, z0, x1, y1, z1), 完全在视口外的边不保存
+	std::vector<float> clipped_;
+	//每条裁剪后的边覆盖的行范围
+	std::vector<int> rows_;
+	//按带排列的裁剪后的边的编号, 每带的起始位置
+	std::vector<int> offsets_;
+	std::vector<int> entries_;
+	int band_;
+
+	void clip(int width, int height);
+	void bin(int height);
+	void raster_band(int band, TGAImage &image, TGAColor color, const float *zbuffer, float zbias) const;
+
+public:
+	struct Stats
+	{
+		double clip_ms, raster_ms;
+		int visible;
+		long long bin_entries;
+		Stats() : clip_ms(0), raster_ms(0), visible(0), bin_entries(0) {}
+		double total_ms() const { return clip_ms + raster_ms; }
+	};
+
+	Wireframe(Model *model, int band = 8);
+	int nedges() const;
+	template <class Project>
+	void project(Model *model, Project project);
+	void draw(TGAImage &image, TGAColor color, const float *zbuffer = NULL, float zbias = 0, Stats *stats = NULL);
+};
+
+/**
+ * @brief 变换所有顶点, 每个顶点只变换一次, 不是每条边两次
+ *
+ * @param project 把模型空间的顶点变换到屏幕坐标, Vec3f project(Vec3f)
+ */
+template <class Project>
+void Wireframe::project(Model *model, Project project)
+{
+	screen_.resize(model->nverts());
+	parallel_for(0, model->nverts(), [&](int begin, int end, int) {
+		for (int i = begin; i < end; ++i)
+		{
+			screen_[i] = project(model->vert(i));
+		}
+	});
+}
+
+#endif //__WIREFRAME_H__
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "arena.h"
+
+static std::atomic<unsigned long> g_heap_allocations(0);
+
+void *operator new(std::size_t n)
+{
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+unsigned long heap_allocations()
+{
+    return g_heap_allocations.load(std::memory_order_relaxed);
+}
+
+// 溢出块的头部, 数据紧跟在后面
+struct Arena::Overflow
+{
+    Overflow *next;
+    size_t pad;
+};
+
+static size_t align_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+Arena::Arena(size_t capacity) : base_(NULL), capacity_(capacity), offset_(0), requested_(0), peak_(0), overflow_(NULL), allocs_(0)
+{
+    base_ = (char *)std::malloc(capacity_);
+}
+
+Arena::~Arena()
+{
+    reset();
+    std::free(base_);
+}
+
+/**
+ * @brief 分配bytes字节, 对齐到align(2的幂), 不需要释放, reset()时整体回收
+ */
+void *Arena::allocate(size_t bytes, size_t align)
+{
+    allocs_++;
+    requested_ += align_up(bytes, align);
+    peak_ = std::max(peak_, requested_);
+    uintptr_t start = align_up((uintptr_t)base_ + offset_, align);
+    size_t end = start - (uintptr_t)base_ + bytes;
+    if (base_ && end <= capacity_)
+    {
+        offset_ = end;
+        return (void *)start;
+    }
+    Overflow *block = (Overflow *)std::malloc(sizeof(Overflow) + bytes + align);
+    if (!block)
+        throw std::bad_alloc();
+    block->next = overflow_;
+    overflow_ = block;
+    return (void *)align_up((uintptr_t)(block + 1), align);
+}
+
+/**
+ * @brief 回收这一帧分配的所有内存; 如果这一帧用了溢出块, 把主块扩大到峰值
+ */
+void Arena::reset()
+{
+    if (overflow_)
+    {
+        while (overflow_)
+        {
+            Overflow *next = overflow_->next;
+            std::free(overflow_);
+            overflow_ = next;
+        }
+        // 对齐会浪费一点空间, 多留一些
+        capacity_ = peak_ + peak_ / 4 + 64;
+        std::free(base_);
+        base_ = (char *)std::malloc(capacity_);
+    }
+    offset_ = 0;
+    requested_ = 0;
+    allocs_ = 0;
+}
+
+size_t Arena::capacity() const
+{
+    return capacity_;
+}
+
+size_t Arena::used() const
+{
+    return requested_;
+}
+
+size_t Arena::peak() const
+{
+    return peak_;
+}
+
+unsigned long Arena::allocs() const
+{
+    return allocs_;
+}
+
+Arena &frame_arena()
+{
+    static Arena arena(1 << 20);
+    return arena;
+}
+
+// 池里的缓冲区前面有一个头部记录容量, 保证数据16字节对齐
+struct PoolHeader
+{
+    size_t capacity;
+    size_t pad;
+};
+
+static size_t pool_capacity(void *p)
+{
+    return ((PoolHeader *)p - 1)->capacity;
+}
+
+BufferPool::BufferPool() : nfree_(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    trim();
+}
+
+/**
+ * @brief 取一个至少bytes字节的缓冲区: 优先用池里最小的够用的那个, 没有才向堆申请
+ */
+void *BufferPool::acquire(size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int best = -1;
+        for (int i = 0; i < nfree_; ++i)
+        {
+            size_t c = pool_capacity(free_[i]);
+            if (c >= bytes && (best < 0 || c < pool_capacity(free_[best])))
+                best = i;
+        }
+        if (best >= 0)
+        {
+            void *p = free_[best];
+            free_[best] = free_[--nfree_];
+            return p;
+        }
+    }
+    PoolHeader *h = (PoolHeader *)std::malloc(sizeof(PoolHeader) + std::max<size_t>(bytes, 1));
+    if (!h)
+        throw std::bad_alloc();
+    h->capacity = bytes;
+    return h + 1;
+}
+
+/**
+ * @brief 归还acquire()得到的缓冲区, 池满时直接释放
+ */
+void BufferPool::release(void *p)
+{
+    if (!p)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (nfree_ < SLOTS)
+    {
+        free_[nfree_++] = p;
+        return;
+    }
+    std::free((PoolHeader *)p - 1);
+}
+
+/**
+ * @brief 释放池里所有空闲的缓冲区
+ */
+void BufferPool::trim()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < nfree_; ++i)
+    {
+        std::free((PoolHeader *)free_[i] - 1);
+    }
+    nfree_ = 0;
+}
+
+BufferPool &buffer_pool()
+{
+    static BufferPool pool;
+    return pool;
+}
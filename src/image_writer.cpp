@@ -0,0 +1,415 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "image_writer.h"
+#include "parallel.h"
+#include "timer.h"
+
+ImageFormat format_from_filename(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+    if (!ext)
+        return IMAGE_TGA_RLE;
+    if (!strcmp(ext, ".ppm") || !strcmp(ext, ".pgm"))
+        return IMAGE_PPM;
+    if (!strcmp(ext, ".pam"))
+        return IMAGE_PAM;
+    if (!strcmp(ext, ".qoi"))
+        return IMAGE_QOI;
+    return IMAGE_TGA_RLE;
+}
+
+static void put(std::vector<unsigned char> &out, const char *s)
+{
+    out.insert(out.end(), s, s + strlen(s));
+}
+
+/**
+ * @brief tga: 翻转只需要把原点设成左下角, 像素按原样写出
+ * rle的分段方式和TGAImage::unload_rle_data相同
+ */
+static void encode_tga(TGAImage &image, bool rle, bool flip, std::vector<unsigned char> &out)
+{
+    int width = image.get_width(), height = image.get_height(), bytespp = image.get_bytespp();
+    const unsigned char *data = image.buffer();
+    TGA_Header header;
+    memset((void *)&header, 0, sizeof(header));
+    header.bitsperpixel = bytespp << 3;
+    header.width = width;
+    header.height = height;
+    header.datatypecode = (bytespp == TGAImage::GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
+    header.imagedescriptor = flip ? 0x00 : 0x20; // bottom-left or top-left origin
+    out.insert(out.end(), (unsigned char *)&header, (unsigned char *)&header + sizeof(header));
+    unsigned long npixels = (unsigned long)width * height;
+    if (!rle)
+    {
+        out.insert(out.end(), data, data + npixels * bytespp);
+    }
+    else
+    {
+        const unsigned char max_chunk_length = 128;
+        unsigned long curpix = 0;
+        while (curpix < npixels)
+        {
+            unsigned long chunkstart = curpix * bytespp;
+            unsigned long curbyte = curpix * bytespp;
+            unsigned char run_length = 1;
+            bool raw = true;
+            while (curpix + run_length < npixels && run_length < max_chunk_length)
+            {
+                bool succ_eq = !memcmp(data + curbyte, data + curbyte + bytespp, bytespp);
+                curbyte += bytespp;
+                if (1 == run_length)
+                {
+                    raw = !succ_eq;
+                }
+                if (raw && succ_eq)
+                {
+                    run_length--;
+                    break;
+                }
+                if (!raw && !succ_eq)
+                {
+                    break;
+                }
+                run_length++;
+            }
+            curpix += run_length;
+            out.push_back(raw ? run_length - 1 : run_length + 127);
+            out.insert(out.end(), data + chunkstart, data + chunkstart + (raw ? run_length * bytespp : bytespp));
+        }
+    }
+    const unsigned char footer[26] = {0, 0, 0, 0, 0, 0, 0, 0, 'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+    out.insert(out.end(), footer, footer + sizeof(footer));
+}
+
+/**
+ * @brief ppm(P6/P5)和pam(P7), 都是自上而下的行, bgr换成rgb
+ */
+static void encode_pnm(TGAImage &image, bool pam, bool flip, std::vector<unsigned char> &out)
+{
+    int width = image.get_width(), height = image.get_height(), bytespp = image.get_bytespp();
+    const unsigned char *data = image.buffer();
+    // ppm没有alpha通道
+    int channels = (bytespp == TGAImage::RGBA && !pam) ? 3 : bytespp;
+    char header[128];
+    if (pam)
+    {
+        const char *tupltype = bytespp == TGAImage::GRAYSCALE ? "GRAYSCALE" : (bytespp == TGAImage::RGB ? "RGB" : "RGB_ALPHA");
+        snprintf(header, sizeof(header), "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n", width, height, channels, tupltype);
+    }
+    else
+    {
+        snprintf(header, sizeof(header), "P%d\n%d %d\n255\n", channels == 1 ? 5 : 6, width, height);
+    }
+    put(out, header);
+    size_t start = out.size();
+    out.resize(start + (size_t)width * height * channels);
+    unsigned char *dst = out.data() + start;
+    for (int y = 0; y < height; ++y)
+    {
+        const unsigned char *src = data + (size_t)(flip ? height - 1 - y : y) * width * bytespp;
+        if (channels == 1)
+        {
+            memcpy(dst, src, width);
+            dst += width;
+            continue;
+        }
+        for (int x = 0; x < width; ++x, src += bytespp, dst += channels)
+        {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            if (channels == 4)
+                dst[3] = src[3];
+        }
+    }
+}
+
+struct QoiPixel
+{
+    unsigned char r, g, b, a;
+};
+
+static QoiPixel qoi_pixel(const unsigned char *p, int bytespp)
+{
+    QoiPixel px;
+    if (bytespp == 1)
+    {
+        px.r = px.g = px.b = p[0];
+        px.a = 255;
+    }
+    else
+    {
+        px.r = p[2];
+        px.g = p[1];
+        px.b = p[0];
+        px.a = bytespp == 4 ? p[3] : 255;
+    }
+    return px;
+}
+
+static bool operator==(const QoiPixel &a, const QoiPixel &b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+/**
+ * @brief 编码[row0, row1)这几行. 每段从前一段最后一个像素开始, 颜色索引表从空开始:
+ * 只使用本段自己写进索引表的颜色, 解码器里这些位置的值一定相同, 所以拼起来就是标准的qoi
+ */
+static void encode_qoi_strip(TGAImage &image, bool flip, int row0, int row1, std::vector<unsigned char> &out)
+{
+    int width = image.get_width(), height = image.get_height(), bytespp = image.get_bytespp();
+    const unsigned char *data = image.buffer();
+    QoiPixel index[64];
+    bool valid[64] = {false};
+    QoiPixel prev = {0, 0, 0, 255};
+    if (row0 > 0)
+    {
+        int y = flip ? height - row0 : row0 - 1;
+        prev = qoi_pixel(data + ((size_t)y * width + width - 1) * bytespp, bytespp);
+    }
+    out.clear();
+    int run = 0;
+    for (int row = row0; row < row1; ++row)
+    {
+        const unsigned char *src = data + (size_t)(flip ? height - 1 - row : row) * width * bytespp;
+        for (int x = 0; x < width; ++x, src += bytespp)
+        {
+            QoiPixel px = qoi_pixel(src, bytespp);
+            if (px == prev)
+            {
+                if (++run == 62)
+                {
+                    out.push_back(0xc0 | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                out.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+            int h = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+            if (valid[h] && index[h] == px)
+            {
+                out.push_back(h);
+            }
+            else
+            {
+                index[h] = px;
+                valid[h] = true;
+                int dr = px.r - prev.r, dg = px.g - prev.g, db = px.b - prev.b;
+                // 差值按8位回绕
+                dr = (signed char)dr;
+                dg = (signed char)dg;
+                db = (signed char)db;
+                int dr_dg = dr - dg, db_dg = db - dg;
+                if (px.a != prev.a)
+                {
+                    unsigned char op[5] = {0xff, px.r, px.g, px.b, px.a};
+                    out.insert(out.end(), op, op + 5);
+                }
+                else if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                {
+                    out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                }
+                else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+                {
+                    out.push_back(0x80 | (dg + 32));
+                    out.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+                }
+                else
+                {
+                    unsigned char op[4] = {0xfe, px.r, px.g, px.b};
+                    out.insert(out.end(), op, op + 4);
+                }
+            }
+            prev = px;
+        }
+    }
+    if (run > 0)
+    {
+        out.push_back(0xc0 | (run - 1));
+    }
+}
+
+/**
+ * @brief qoi: 按行分段编码, 再拼接起来; parallel为true时各段在线程池上并行编码, 为false时在当前线程上依次编码
+ */
+static void encode_qoi(TGAImage &image, bool flip, std::vector<unsigned char> &out, std::vector<std::vector<unsigned char> > &strips, bool parallel)
+{
+    int width = image.get_width(), height = image.get_height();
+    const int rows_per_strip = 32;
+    int nstrips = (height + rows_per_strip - 1) / rows_per_strip;
+    if ((int)strips.size() < nstrips)
+        strips.resize(nstrips);
+    auto encode_strips = [&](int begin, int end, int) {
+        for (int s = begin; s < end; ++s)
+        {
+            encode_qoi_strip(image, flip, s * rows_per_strip, std::min(height, (s + 1) * rows_per_strip), strips[s]);
+        }
+    };
+    if (parallel)
+        parallel_for(0, nstrips, encode_strips, 1);
+    else
+        encode_strips(0, nstrips, 0);
+    unsigned char header[14] = {'q', 'o', 'i', 'f',
+                                (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+                                (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+                                (unsigned char)(image.get_bytespp() == TGAImage::RGBA ? 4 : 3), 0};
+    out.insert(out.end(), header, header + sizeof(header));
+    for (int s = 0; s < nstrips; ++s)
+    {
+        out.insert(out.end(), strips[s].begin(), strips[s].end());
+    }
+    const unsigned char end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    out.insert(out.end(), end_marker, end_marker + sizeof(end_marker));
+}
+
+void encode_image(TGAImage &image, ImageFormat format, bool flip, std::vector<unsigned char> &out,
+                  std::vector<std::vector<unsigned char> > *strips, bool parallel)
+{
+    out.clear();
+    if (!image.buffer())
+        return;
+    switch (format)
+    {
+    case IMAGE_TGA:
+    case IMAGE_TGA_RLE:
+        encode_tga(image, format == IMAGE_TGA_RLE, flip, out);
+        break;
+    case IMAGE_PPM:
+    case IMAGE_PAM:
+        encode_pnm(image, format == IMAGE_PAM, flip, out);
+        break;
+    case IMAGE_QOI:
+    {
+        std::vector<std::vector<unsigned char> > local;
+        encode_qoi(image, flip, out, strips ? *strips : local, parallel);
+        break;
+    }
+    }
+}
+
+bool write_file(const char *filename, const unsigned char *data, size_t size)
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+    {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    // 不带缓冲, 整段数据一次写出
+    setvbuf(f, NULL, _IONBF, 0);
+    bool ok = fwrite(data, 1, size, f) == size;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+        std::cerr << "can't write file " << filename << "\n";
+    return ok;
+}
+
+ImageWriter::ImageWriter() : head_(0), count_(0), stop_(false)
+{
+    thread_ = std::thread(&ImageWriter::loop, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    not_empty_.notify_one();
+    thread_.join();
+}
+
+/**
+ * @brief 把图像交给后台线程写出, 只在渲染线程上拷贝一次像素
+ *
+ * @return bool 文件名超过MAX_FILENAME-1个字符时不写, 返回false
+ */
+bool ImageWriter::submit(TGAImage &image, const char *filename, ImageFormat format, bool flip)
+{
+    if (strlen(filename) >= (size_t)MAX_FILENAME)
+    {
+        std::cerr << "file name too long: " << filename << "\n";
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.failed++;
+        return false;
+    }
+    Timer timer;
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [&] { return count_ < QUEUE; });
+    Job &job = jobs_[(head_ + count_) % QUEUE];
+    // 后台线程只处理head_开始的count_项, 不会读这一项, 拷贝放在锁里只是为了简单
+    job.image = image;
+    strcpy(job.filename, filename);
+    job.format = format;
+    job.flip = flip;
+    count_++;
+    stats_.submit_ms += timer.elapsed_ms();
+    lock.unlock();
+    not_empty_.notify_one();
+    return true;
+}
+
+/**
+ * @brief 等待队列里所有的图像写完
+ */
+void ImageWriter::flush()
+{
+    Timer timer;
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [&] { return count_ == 0; });
+    stats_.flush_ms += timer.elapsed_ms();
+}
+
+ImageWriter::Stats ImageWriter::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ImageWriter::loop()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [&] { return stop_ || count_ > 0; });
+        if (count_ == 0)
+            return;
+        Job &job = jobs_[head_];
+        lock.unlock();
+
+        Timer timer;
+        // 不用线程池: 线程池同一时间只执行一批任务, 后台编码占着它时渲染线程的parallel_for和分块渲染都会退化成串行
+        encode_image(job.image, job.format, job.flip, buffer_, &strips_, false);
+        double encode_ms = timer.elapsed_ms();
+        timer.reset();
+        bool ok = write_file(job.filename, buffer_.data(), buffer_.size());
+        double write_ms = timer.elapsed_ms();
+
+        lock.lock();
+        stats_.encode_ms += encode_ms;
+        stats_.write_ms += write_ms;
+        if (ok)
+        {
+            stats_.files++;
+            stats_.raw_bytes += (size_t)job.image.get_width() * job.image.get_height() * job.image.get_bytespp();
+            stats_.encoded_bytes += buffer_.size();
+        }
+        else
+        {
+            stats_.failed++;
+        }
+        head_ = (head_ + 1) % QUEUE;
+        count_--;
+        lock.unlock();
+        not_full_.notify_all();
+    }
+}
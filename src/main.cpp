@@ -1,8 +1,19 @@
 #include <vector>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include "tgaimage.h"
 #include "model.h"
 #include "geometry.h"
+#include "our_gl.h"
+#include "shading.h"
+#include "shadow.h"
+#include "ssao.h"
+#include "arena.h"
+#include "image_writer.h"
+#include "pipeline.h"
+#include "wireframe.h"
+#include "timer.h"
 #define DEPTH 255
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
@@ -10,11 +21,145 @@ const TGAColor green = TGAColor(0, 255, 0, 255);
 Model *model = NULL;
 const int width = 800;
 const int height = 800;
-void triangle(Vec3f *screen_coords, float *zbuffer, TGAImage &image, TGAColor color);
 void triangle(Vec3f *screen_coords, float *zbuffer, TGAImage &image, TGAImage &tex, Vec3f *tex_coords, float &intensity);
+void clear(TGAImage &image, float *zbuffer);
+void render(TGAImage &image, float *zbuffer, TGAImage &tex, ShadeMode mode, ShadowMap *shadow = NULL, bool zprepass = false, TilePipeline *pipeline = NULL);
+void render_reference(TGAImage &image, float *zbuffer, TGAImage &tex);
 void line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color);
-Vec3f Barycentric(Vec3f *vertex, Vec2f p);
 const Vec3f camera = Vec3f(0, 0, 3);
+Vec3f light_dir(0, 0, -1);
+// 打开阴影时使用的光线方向, 从左上前方照过来
+const Vec3f shadow_light_dir = Vec3f(1, -1, -1).normalize();
+const int shadow_size = 1024;
+// 线框的深度测试容差, 边和它所在的面深度相同
+const float wireframe_zbias = 0.02f;
+
+/**
+ * @brief 透视投影加视口变换, 得到屏幕坐标
+ * rhw为1/w, 即透视除法乘上的系数, 光栅化时用它做透视校正插值
+ */
+inline Vec3f project(Vec3f v, float &rhw)
+{
+    rhw = 1 / (1 - v.z / camera.z);
+    return Vec3f((v.x * rhw + 1) * width / 2, (v.y * rhw + 1) * height / 2, v.z * rhw);
+}
+
+inline Vec3f project(Vec3f v)
+{
+    float rhw;
+    return project(v, rhw);
+}
+
+// 每个面一个光照强度, 三个顶点上的值相同
+struct FlatShader
+{
+    enum { NVARYING = 3 };
+    TGAImage *tex;
+
+    Vec3f vertex(int iface, int nthvert, float *varying, float &rhw) const
+    {
+        // 计算的不是面的法线, 而是面的法线的反向向量, 因为要和入射光的方向点乘得到光照强度
+        Vec3f v0 = model->vert(iface, 0);
+        Vec3f n = ((model->vert(iface, 2) - v0) ^ (model->vert(iface, 1) - v0)).normalize();
+        Vec3f vt = model->texture(iface, nthvert);
+        varying[0] = vt.x * tex->get_width();
+        varying[1] = vt.y * tex->get_height();
+        varying[2] = std::max(0.f, n * light_dir);
+        return project(model->vert(iface, nthvert), rhw);
+    }
+
+    void fragment(const float (*varying)[SPAN], int n, TGAColor *color) const
+    {
+        for (int p = 0; p < n; ++p)
+        {
+            color[p] = tex->get(varying[0][p], varying[1][p]);
+            for (int k = 0; k < 3; ++k)
+            {
+                color[p].raw[k] *= varying[2][p];
+            }
+        }
+    }
+};
+
+// 顶点上算光照, 插值光照强度
+struct GouraudShader
+{
+    enum { NVARYING = 3 };
+    TGAImage *tex;
+
+    Vec3f vertex(int iface, int nthvert, float *varying, float &rhw) const
+    {
+        Vec3f vt = model->texture(iface, nthvert);
+        varying[0] = vt.x * tex->get_width();
+        varying[1] = vt.y * tex->get_height();
+        varying[2] = std::max(0.f, model->norm(iface, nthvert).normalize() * (light_dir * -1));
+        return project(model->vert(iface, nthvert), rhw);
+    }
+
+    void fragment(const float (*varying)[SPAN], int n, TGAColor *color) const
+    {
+        for (int p = 0; p < n; ++p)
+        {
+            color[p] = tex->get(varying[0][p], varying[1][p]);
+            for (int k = 0; k < 3; ++k)
+            {
+                color[p].raw[k] *= varying[2][p];
+            }
+        }
+    }
+};
+
+// 插值法线, 整段像素一起归一化并计算光照
+// SHADOW 为true时额外插值模型空间坐标, 在shadow map里做PCF
+template <bool SHADOW>
+struct PhongShader
+{
+    enum { NVARYING = SHADOW ? 8 : 5 };
+    TGAImage *tex;
+    ShadowMap *shadow;
+
+    Vec3f vertex(int iface, int nthvert, float *varying, float &rhw) const
+    {
+        Vec3f vt = model->texture(iface, nthvert);
+        Vec3f n = model->norm(iface, nthvert);
+        Vec3f v = model->vert(iface, nthvert);
+        varying[0] = vt.x * tex->get_width();
+        varying[1] = vt.y * tex->get_height();
+        varying[2] = n.x;
+        varying[3] = n.y;
+        varying[4] = n.z;
+        if (SHADOW)
+        {
+            varying[5] = v.x;
+            varying[6] = v.y;
+            varying[7] = v.z;
+        }
+        return project(v, rhw);
+    }
+
+    void fragment(const float (*varying)[SPAN], int n, TGAColor *color) const
+    {
+        float intensity[SPAN];
+        lambert_batch(varying[2], varying[3], varying[4], light_dir * -1, intensity, n);
+        if (SHADOW)
+        {
+            for (int p = 0; p < n; ++p)
+            {
+                // 阴影里保留30%的光照
+                float lit = shadow->lit(Vec3f(varying[5][p], varying[6][p], varying[7][p]), 1, .02f);
+                intensity[p] *= .3f + .7f * lit;
+            }
+        }
+        for (int p = 0; p < n; ++p)
+        {
+            color[p] = tex->get(varying[0][p], varying[1][p]);
+            for (int k = 0; k < 3; ++k)
+            {
+                color[p].raw[k] *= intensity[p];
+            }
+        }
+    }
+};
 
 void line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color)
 {
@@ -68,16 +213,72 @@ void line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color)
     }
 }
 
+/**
+ * @brief 用法: main [model.obj] [--subdivide N] [--flat|--gouraud|--phong] [--shadow] [--zprepass] [--ssao] [--tiled] [--wireframe [--xray]] [-o file] [--bench]
+ * --subdivide N 把每个三角形细分N次(面数乘以4^N), 用来测试很大的模型
+ * --tiled 几何处理和分块光栅化在不同的线程上流水线执行
+ * --shadow 光线改为从左上前方照射并计算阴影, 只能和phong着色一起用
+ * --zprepass 先只画深度, 再着色, 减少被遮挡像素的着色
+ * --ssao [--ssao-samples N] 对最终的深度缓冲做屏幕空间环境光遮蔽, 输出每个阶段的耗时
+ * --wireframe 在结果上叠加线框, 被挡住的边不画; 加上--xray时画出所有的边
+ * -o file 输出文件, 根据扩展名选择格式: .tga(默认output.tga) .ppm .pam .qoi, 在后台线程编码和写出
+ * --bench 对每种着色方式分别渲染多帧并输出每帧耗时, 包括手写的flat光栅化作为对照
+ */
 int main(int argc, char **argv)
 {
-    if (2 == argc)
+    const char *filename = "obj/african_head.obj";
+    const char *output = "output.tga";
+    ShadeMode mode = PHONG;
+    bool bench = false;
+    bool shadow = false;
+    bool zprepass = false;
+    bool tiled = false;
+    bool wireframe = false;
+    bool xray = false;
+    int subdivide = 0;
+    bool ao = false;
+    SSAOParams ao_params;
+    ao_params.depth_scale = width / 2.f;
+    ao_params.background = -DEPTH;
+    for (int i = 1; i < argc; ++i)
     {
-        model = new Model(argv[1]);
+        if (!strcmp(argv[i], "--flat"))
+            mode = FLAT;
+        else if (!strcmp(argv[i], "--gouraud"))
+            mode = GOURAUD;
+        else if (!strcmp(argv[i], "--phong"))
+            mode = PHONG;
+        else if (!strcmp(argv[i], "--shadow"))
+            shadow = true;
+        else if (!strcmp(argv[i], "--zprepass"))
+            zprepass = true;
+        else if (!strcmp(argv[i], "--ssao"))
+            ao = true;
+        else if (!strcmp(argv[i], "--ssao-samples") && i + 1 < argc)
+            ao_params.samples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--tiled"))
+            tiled = true;
+        else if (!strcmp(argv[i], "--wireframe"))
+            wireframe = true;
+        else if (!strcmp(argv[i], "--xray"))
+            xray = true;
+        else if (!strcmp(argv[i], "--subdivide") && i + 1 < argc)
+            subdivide = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if (!strcmp(argv[i], "--bench"))
+            bench = true;
+        else
+            filename = argv[i];
     }
-    else
+    if (shadow && mode != PHONG)
     {
-        model = new Model("obj/african_head.obj");
+        std::cerr << "--shadow only works with --phong" << std::endl;
+        return 1;
     }
+    model = new Model(filename);
+    if (subdivide > 0)
+        model->subdivide(subdivide);
 
     TGAImage image(width, height, TGAImage::RGB);
     TGAImage tex;
@@ -87,89 +288,330 @@ int main(int argc, char **argv)
         return 0;
     }
     tex.flip_vertically();
-    Vec3f light_dir(0, 0, -1);
-    float *zbuffer = new float[width * height];
+    float *zbuffer = (float *)buffer_pool().acquire(sizeof(float) * width * height);
+    float *ao_buffer = (float *)buffer_pool().acquire(sizeof(float) * width * height);
+    ShadowMap shadow_map(shadow_size);
+    TilePipeline pipeline;
+    if (bench)
+    {
+        const int frames = 20;
+        Timer timer;
+        for (int k = 0; k < frames; ++k)
+        {
+            render_reference(image, zbuffer, tex);
+        }
+        std::cerr << "# bench flat (hand-written, per-pixel barycentric): " << timer.elapsed_ms() / frames << " ms/frame" << std::endl;
+        const char *names[3] = {"flat", "gouraud", "phong"};
+        for (int m = FLAT; m <= PHONG; ++m)
+        {
+            timer.reset();
+            for (int k = 0; k < frames; ++k)
+            {
+                render(image, zbuffer, tex, (ShadeMode)m);
+            }
+            std::cerr << "# bench " << names[m] << ": " << timer.elapsed_ms() / frames << " ms/frame" << std::endl;
+        }
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            render(image, zbuffer, tex, PHONG, NULL, true);
+        }
+        std::cerr << "# bench phong + zprepass: " << timer.elapsed_ms() / frames << " ms/frame" << std::endl;
+        // 单独测只画深度的光栅化的吞吐量
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            shadow_map.render(model, shadow_light_dir);
+        }
+        double ms = timer.elapsed_ms() / frames;
+        std::cerr << "# bench shadow map " << shadow_size << "x" << shadow_size << ": " << ms << " ms/frame, "
+                  << model->nfaces() / ms / 1000 << " Mtri/s" << std::endl;
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            clear(image, zbuffer);
+            draw_depth(model, [](Vec3f v) { return project(v); }, zbuffer, width, height, true);
+        }
+        ms = timer.elapsed_ms() / frames;
+        std::cerr << "# bench z-prepass: " << ms << " ms/frame, " << model->nfaces() / ms / 1000 << " Mtri/s" << std::endl;
+        Vec3f saved = light_dir;
+        light_dir = shadow_light_dir;
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            render(image, zbuffer, tex, PHONG, &shadow_map);
+        }
+        std::cerr << "# bench phong + shadow (main pass): " << timer.elapsed_ms() / frames << " ms/frame" << std::endl;
+        light_dir = saved;
+        render(image, zbuffer, tex, PHONG);
+        SSAOTimings sum;
+        for (int k = 0; k < frames; ++k)
+        {
+            frame_arena().reset();
+            SSAOTimings t;
+            ssao(zbuffer, width, height, ao_params, ao_buffer, &t);
+            apply_ao(image, ao_buffer, &t);
+            sum.ao_ms += t.ao_ms / frames;
+            sum.blur_ms += t.blur_ms / frames;
+            sum.apply_ms += t.apply_ms / frames;
+        }
+        std::cerr << "# bench ssao " << ao_params.samples << " samples: ao " << sum.ao_ms << " ms, blur " << sum.blur_ms
+                  << " ms, apply " << sum.apply_ms << " ms, total " << sum.total_ms() << " ms/frame" << std::endl;
+        // 批量渲染的稳态: 第一帧之后不应该再有堆分配, 包括分块流水线; 回归测试检查这里输出的分配次数
+        light_dir = shadow_light_dir;
+        unsigned long allocs = 0;
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            if (k == 1)
+                allocs = heap_allocations();
+            frame_arena().reset();
+            shadow_map.render(model, light_dir);
+            render(image, zbuffer, tex, PHONG, &shadow_map);
+            render(image, zbuffer, tex, PHONG, &shadow_map, false, &pipeline);
+            ssao(zbuffer, width, height, ao_params, ao_buffer);
+            apply_ao(image, ao_buffer);
+        }
+        std::cerr << "# bench batch phong + shadow + tiled + ssao: " << timer.elapsed_ms() / frames << " ms/frame, "
+                  << (heap_allocations() - allocs) / (double)(frames - 1) << " heap allocs/frame, arena peak "
+                  << frame_arena().peak() / 1024 << " KB" << std::endl;
+        light_dir = saved;
+        // 分块流水线和串行draw()的对比, 两者的输出应该完全相同
+        TGAImage serial(width, height, TGAImage::RGB);
+        render(serial, zbuffer, tex, PHONG);
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            render(image, zbuffer, tex, PHONG, NULL, false, &pipeline);
+        }
+        const TilePipeline::Stats &ps = pipeline.stats();
+        // 线程数放在冒号后面, 名字不随机器变化, 回归测试按名字查baseline
+        std::cerr << "# bench phong tiled: " << timer.elapsed_ms() / frames << " ms/frame, " << pipeline.config().geometry_threads
+                  << " geometry + " << pipeline.config().raster_threads << " raster threads, geometry " << ps.geometry_ms << " ms, raster "
+                  << ps.raster_ms << " ms, overlap " << ps.overlap_ms() << " ms, " << ps.bin_entries / (double)std::max(1L, ps.triangles)
+                  << " tiles/tri, " << ps.steals << " steals, "
+                  << (memcmp(serial.buffer(), image.buffer(), width * height * image.get_bytespp()) ? "DIFFERENT from" : "identical to")
+                  << " serial" << std::endl;
+        // 线框: 取边只做一次, 每帧变换顶点, 裁剪, 分带光栅化
+        timer.reset();
+        Wireframe bench_wire(model);
+        double extract_ms = timer.elapsed_ms();
+        TGAColor white(255, 255, 255, 255);
+        Wireframe::Stats ws;
+        for (int hidden = 0; hidden < 2; ++hidden)
+        {
+            render(image, zbuffer, tex, PHONG);
+            timer.reset();
+            for (int k = 0; k < frames; ++k)
+            {
+                bench_wire.project(model, [](Vec3f v) { return project(v); });
+                bench_wire.draw(image, white, hidden ? zbuffer : NULL, wireframe_zbias, &ws);
+            }
+            ms = timer.elapsed_ms() / frames;
+            std::cerr << "# bench wireframe" << (hidden ? " hidden-line" : "") << " " << bench_wire.nedges() << " edges: " << ms
+                      << " ms/frame, " << bench_wire.nedges() / ms / 1000 << " Medges/s, clip " << ws.clip_ms << " ms, raster "
+                      << ws.raster_ms << " ms, extract " << extract_ms << " ms once" << std::endl;
+        }
+        // 原来的画法: 每个面三条边(共享边画两次), 逐像素set(), 不裁剪
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            for (int i = 0; i < model->nfaces(); ++i)
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    Vec3f a = project(model->vert(i, j)), b = project(model->vert(i, (j + 1) % 3));
+                    line(a.x, a.y, b.x, b.y, image, white);
+                }
+            }
+        }
+        ms = timer.elapsed_ms() / frames;
+        std::cerr << "# bench wireframe line() per face: " << ms << " ms/frame, " << bench_wire.nedges() / ms / 1000 << " Medges/s" << std::endl;
+        // 各种输出格式的编码速度, 翻转在编码时完成
+        const char *format_names[5] = {"tga", "tga rle", "ppm", "pam", "qoi"};
+        std::vector<unsigned char> encoded;
+        std::vector<std::vector<unsigned char> > strips;
+        double raw_mb = width * height * image.get_bytespp() / 1e6;
+        for (int f = IMAGE_TGA; f <= IMAGE_QOI; ++f)
+        {
+            timer.reset();
+            for (int k = 0; k < frames; ++k)
+            {
+                encode_image(image, (ImageFormat)f, true, encoded, &strips);
+            }
+            double ms = timer.elapsed_ms() / frames;
+            std::cerr << "# bench encode " << format_names[f] << ": " << ms << " ms, " << raw_mb / ms * 1e3 << " MB/s, "
+                      << encoded.size() / 1024 << " KB" << std::endl;
+        }
+        // 每帧渲染后写出文件: 在渲染线程上同步编码和写, 和交给ImageWriter在后台写比较, 差值是渲染线程省下的时间
+        const ImageFormat out_format = format_from_filename(output);
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            render(image, zbuffer, tex, PHONG);
+            encode_image(image, out_format, true, encoded, &strips);
+            write_file(output, encoded.data(), encoded.size());
+        }
+        double sync_ms = timer.elapsed_ms() / frames;
+        ImageWriter bench_writer;
+        timer.reset();
+        for (int k = 0; k < frames; ++k)
+        {
+            render(image, zbuffer, tex, PHONG);
+            bench_writer.submit(image, output, out_format, true);
+        }
+        bench_writer.flush();
+        double async_ms = timer.elapsed_ms() / frames;
+        ImageWriter::Stats bs = bench_writer.stats();
+        std::cerr << "# bench phong + write sync: " << sync_ms << " ms/frame" << std::endl;
+        std::cerr << "# bench phong + write async: " << async_ms << " ms/frame, saved " << sync_ms - async_ms
+                  << " ms/frame, render thread blocked " << bs.blocked_ms() / frames << " ms/frame" << std::endl;
+    }
+    frame_arena().reset();
+    if (shadow)
+    {
+        light_dir = shadow_light_dir;
+        shadow_map.render(model, light_dir);
+    }
+    render(image, zbuffer, tex, mode, shadow ? &shadow_map : NULL, zprepass, tiled ? &pipeline : NULL);
+    if (tiled)
+    {
+        const TilePipeline::Stats &ps = pipeline.stats();
+        std::cerr << "# tiled: " << ps.total_ms << " ms, " << ps.triangles << " triangles, geometry " << ps.geometry_ms
+                  << " ms, raster " << ps.raster_ms << " ms, overlap " << ps.overlap_ms() << " ms" << std::endl;
+    }
+    if (ao)
+    {
+        SSAOTimings t;
+        ssao(zbuffer, width, height, ao_params, ao_buffer, &t);
+        apply_ao(image, ao_buffer, &t);
+        std::cerr << "# ssao: ao " << t.ao_ms << " ms, blur " << t.blur_ms << " ms, apply " << t.apply_ms << " ms" << std::endl;
+    }
+    if (wireframe)
+    {
+        Timer timer;
+        Wireframe wire(model);
+        double extract_ms = timer.elapsed_ms();
+        Wireframe::Stats ws;
+        wire.project(model, [](Vec3f v) { return project(v); });
+        wire.draw(image, TGAColor(255, 255, 255, 255), xray ? NULL : zbuffer, wireframe_zbias, &ws);
+        std::cerr << "# wireframe: " << wire.nedges() << " edges, " << ws.visible << " on screen, extract " << extract_ms << " ms, clip "
+                  << ws.clip_ms << " ms, raster " << ws.raster_ms << " ms, " << wire.nedges() / ws.total_ms() / 1000 << " Medges/s" << std::endl;
+    }
+    // i want to have the origin at the left bottom corner of the image, 翻转由编码器完成
+    // 只写一帧, 没有可以重叠的渲染, 阻塞时间约等于同步写的时间; 连续渲染时省下的时间见--bench
+    ImageWriter writer;
+    writer.submit(image, output, format_from_filename(output), true);
+    writer.flush();
+    ImageWriter::Stats stats = writer.stats();
+    if (stats.failed)
+        std::cerr << "# output " << output << ": write failed" << std::endl;
+    else
+        std::cerr << "# output " << output << ": encode " << stats.encode_mb_per_s() << " MB/s, " << stats.encoded_bytes / 1024
+                  << " KB, render thread blocked " << stats.blocked_ms() << " ms (submit " << stats.submit_ms << " ms, flush "
+                  << stats.flush_ms << " ms)" << std::endl;
+    buffer_pool().release(zbuffer);
+    buffer_pool().release(ao_buffer);
+    delete model;
+    return stats.failed ? 1 : 0;
+}
+
+/**
+ * @brief 用draw()或者分块流水线画出模型
+ */
+template <class Shader>
+void draw_shaded(const Shader &shader, TGAImage &image, float *zbuffer, float zbias, TilePipeline *pipeline)
+{
+    if (pipeline)
+        pipeline->draw(model, shader, image, zbuffer, zbias);
+    else
+        draw(model, shader, image, zbuffer, zbias);
+}
+
+/**
+ * @brief 清空image和zbuffer
+ */
+void clear(TGAImage &image, float *zbuffer)
+{
+    image.clear();
     for (int i = 0; i < width * height; ++i)
     {
         zbuffer[i] = -DEPTH;
     }
+}
+
+/**
+ * @brief 渲染一帧到image, 会先清空image和zbuffer
+ *
+ * @param mode FLAT 每个面一个法线; GOURAUD 顶点算光照再插值; PHONG 插值法线逐像素算光照
+ * @param shadow 不为空时(phong着色)计算阴影, 需要事先用当前的light_dir渲染好
+ * @param zprepass 先只画深度, 着色时只有最终可见的像素能通过深度测试
+ * @param pipeline 不为空时用分块流水线光栅化
+ */
+void render(TGAImage &image, float *zbuffer, TGAImage &tex, ShadeMode mode, ShadowMap *shadow, bool zprepass, TilePipeline *pipeline)
+{
+    clear(image, zbuffer);
+    float zbias = 0;
+    if (zprepass)
+    {
+        draw_depth(model, [](Vec3f v) { return project(v); }, zbuffer, width, height, true);
+        zbias = 1e-4f;
+    }
+    if (mode == FLAT)
+    {
+        FlatShader shader;
+        shader.tex = &tex;
+        draw_shaded(shader, image, zbuffer, zbias, pipeline);
+    }
+    else if (mode == GOURAUD)
+    {
+        GouraudShader shader;
+        shader.tex = &tex;
+        draw_shaded(shader, image, zbuffer, zbias, pipeline);
+    }
+    else if (shadow)
+    {
+        PhongShader<true> shader;
+        shader.tex = &tex;
+        shader.shadow = shadow;
+        draw_shaded(shader, image, zbuffer, zbias, pipeline);
+    }
+    else
+    {
+        PhongShader<false> shader;
+        shader.tex = &tex;
+        shader.shadow = NULL;
+        draw_shaded(shader, image, zbuffer, zbias, pipeline);
+    }
+}
+
+/**
+ * @brief 手写的flat着色, 不经过着色器, 用来和draw()对比开销
+ */
+void render_reference(TGAImage &image, float *zbuffer, TGAImage &tex)
+{
+    clear(image, zbuffer);
     for (int i = 0; i < model->nfaces(); i++)
     {
-        std::vector<Vec2i> face = model->face(i);
         Vec3f screen_coords[3];
         Vec3f world_coords[3];
         Vec3f tex_coords[3];
         for (int j = 0; j < 3; j++)
         {
-            Vec3f v0 = model->vert(face[j].x);
-            Vec3f vt = model->texture(face[j].y);
+            Vec3f v0 = model->vert(i, j);
+            Vec3f vt = model->texture(i, j);
             world_coords[j] = v0;
-            // screen_coords[j] = Vec3f((v0.x + 1) * width / 2, (v0.y + 1) * height / 2, v0.z);
             tex_coords[j] = Vec3f(vt.x * tex.get_width(), vt.y * tex.get_height(), 0.);
-            screen_coords[j] = Vec3f(((v0.x / (1 - v0.z / camera.z)) + 1) * width / 2 , ((v0.y / (1 - v0.z / camera.z)) + 1) * height / 2, v0.z / (1 - v0.z / camera.z));
-            // tex_coords[j] = Vec3f(vt.x * tex.get_width(), vt.y * tex.get_height(), 0.);
+            screen_coords[j] = project(v0);
         }
         // 计算的不是面的法线, 而是面的法线的反向向量, 因为要和入射光的方向点乘得到光照强度
         Vec3f n = ((world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0])).normalize();
         float intensity = n * light_dir;
-        // intensity *= intensity;
         if (intensity > 0)
         {
             triangle(screen_coords, zbuffer, image, tex, tex_coords, intensity);
         }
     }
-    image.flip_vertically(); // i want to have the origin at the left bottom corner of the image
-    image.write_tga_file("output.tga");
-    delete model;
-    return 0;
-}
-
-// with z-buffer
-void triangle(Vec3f *screen_coords, float *zbuffer, TGAImage &image, TGAColor color)
-{
-    float max[2], min[2];
-    min[0] = width;
-    min[1] = height;
-    max[0] = max[1] = 0;
-    for (int i = 0; i < 3; ++i)
-    {
-        for (int j = 0; j < 2; ++j)
-        {
-            max[j] = screen_coords[i].raw[j] < max[j] ? max[j] : screen_coords[i].raw[j];
-            min[j] = screen_coords[i].raw[j] < min[j] ? screen_coords[i].raw[j] : min[j];
-        }
-    }
-    for (int i = min[0]; i <= max[0]; ++i)
-    {
-        for (int j = min[1]; j <= max[1]; ++j)
-        {
-            Vec3f barycentric_coords = Barycentric(screen_coords, Vec2f(i, j));
-            if (barycentric_coords.x >= 0 && barycentric_coords.y >= 0 && barycentric_coords.z >= 0)
-            {
-                float z_new = screen_coords[0].z * barycentric_coords.x + screen_coords[1].z * barycentric_coords.y + screen_coords[2].z * barycentric_coords.z;
-                if (z_new > zbuffer[i * width + j])
-                {
-                    image.set(i, j, color);
-                    zbuffer[i * width + j] = z_new;
-                }
-            }
-        }
-    }
-}
-
-Vec3f Barycentric(Vec3f *vertex, Vec2f p)
-{
-    Vec3f res;
-    Vec2f v[3];
-    for (int i = 0; i < 3; ++i)
-    {
-        v[i].x = vertex[i].x;
-        v[i].y = vertex[i].y;
-    }
-    res.raw[0] = ((v[1] - p) ^ (v[2] - p)) / ((v[1] - v[0]) ^ (v[2] - v[0]));
-    res.raw[1] = ((v[2] - p) ^ (v[0] - p)) / ((v[2] - v[1]) ^ (v[0] - v[1]));
-    res.raw[2] = 1 - res.x - res.y;
-    return res;
 }
 
 void triangle(Vec3f *screen_coords, float *zbuffer, TGAImage &image, TGAImage &tex, Vec3f *tex_coords, float &intensity)
@@ -186,15 +628,20 @@ void triangle(Vec3f *screen_coords, float *zbuffer, TGAImage &image, TGAImage &t
             min[j] = screen_coords[i].raw[j] < min[j] ? screen_coords[i].raw[j] : min[j];
         }
     }
-    for (int i = min[0]; i <= max[0]; ++i)
+    // 裁剪到屏幕范围内
+    min[0] = std::max(min[0], 0.f);
+    min[1] = std::max(min[1], 0.f);
+    max[0] = std::min(max[0], (float)(width - 1));
+    max[1] = std::min(max[1], (float)(height - 1));
+    for (int j = min[1]; j <= max[1]; ++j)
     {
-        for (int j = min[1]; j <= max[1]; ++j)
+        for (int i = min[0]; i <= max[0]; ++i)
         {
             Vec3f barycentric_coords = Barycentric(screen_coords, Vec2f(i, j));
             if (barycentric_coords.x >= 0 && barycentric_coords.y >= 0 && barycentric_coords.z >= 0)
             {
                 float z_new = screen_coords[0].z * barycentric_coords.x + screen_coords[1].z * barycentric_coords.y + screen_coords[2].z * barycentric_coords.z;
-                if (z_new > zbuffer[i * width + j])
+                if (z_new > zbuffer[j * width + i])
                 {
                     int u, v;
                     u = tex_coords[0].x * barycentric_coords.x + tex_coords[1].x * barycentric_coords.y + tex_coords[2].x * barycentric_coords.z;
@@ -205,9 +652,9 @@ void triangle(Vec3f *screen_coords, float *zbuffer, TGAImage &image, TGAImage &t
                         color.raw[k] *= intensity;
                     }
                     image.set(i, j, color);
-                    zbuffer[i * width + j] = z_new / (1 - z_new / camera.z);
+                    zbuffer[j * width + i] = z_new;
                 }
             }
         }
     }
-}
\ No newline at end of file
+}
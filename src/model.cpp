@@ -1,13 +1,18 @@
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 #include "model.h"
+#include "parallel.h"
 
 
 /**
- * @brief Construct a new Model:: Model object, 读入顶点信息和面的信息, 不涉及面的纹理和法线
+ * @brief Construct a new Model:: Model object, 读入顶点, 纹理, 法线和面的信息
+ * 多边形的面按扇形拆成三角形, 面的顶点可以不带纹理或法线下标(v, v/vt, v//vn, v/vt/vn)
+ * 有面缺少法线时按面积加权计算所有顶点的法线, 缺少纹理坐标时用(0, 0)
  * 输出一条cerr提示程序员读入的顶点个数和面个数
  * 
  * @param filename 文件的相对地址
@@ -42,21 +47,135 @@ Model::Model(const char *filename) : verts_(), faces_()
             }
             textures_.push_back(v);
         }
+        else if (!line.compare(0, 3, "vn "))
+        {
+            iss >> trash >> trash;
+            float n[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                iss >> n[i];
+            }
+            norms_x_.push_back(n[0]);
+            norms_y_.push_back(n[1]);
+            norms_z_.push_back(n[2]);
+        }
         else if (!line.compare(0, 2, "f "))
         {
-            std::vector<Vec2i> f;
-            int itrash, idx, idx_t;
+            Vec3i first, last;
+            int n = 0;
+            std::string token;
             iss >> trash;
-            while (iss >> idx >> trash >> idx_t >> trash >> itrash)
+            // 每个顶点可以写成 v, v/vt, v//vn 或 v/vt/vn, 缺少的下标记为-1
+            while (iss >> token)
             {
-                idx--; // in wavefront obj all indices start at 1, not zero
-                idx_t--;
-                f.push_back(Vec2i(idx, idx_t));
+                int idx[3] = {0, 0, 0};
+                char *p = &token[0];
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (*p != '/')
+                        idx[k] = (int)strtol(p, &p, 10);
+                    if (*p != '/')
+                        break;
+                    ++p;
+                }
+                // in wavefront obj all indices start at 1, not zero; 负数是从已经读入的末尾往前数
+                auto resolve = [](int i, size_t count) { return i > 0 ? i - 1 : i < 0 ? (int)count + i : -1; };
+                Vec3i v(resolve(idx[0], verts_.size()), resolve(idx[1], textures_.size()), resolve(idx[2], norms_x_.size()));
+                if (v.ivert < 0)
+                    break;
+                if (n == 0)
+                    first = v;
+                else if (n >= 2)
+                {
+                    faces_.push_back(first);
+                    faces_.push_back(last);
+                    faces_.push_back(v);
+                }
+                last = v;
+                n++;
             }
-            faces_.push_back(f);
         }
     }
-    std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << " vt# " << textures_.size() << std::endl;
+    bool missing_uv = false, missing_norm = false;
+    for (const Vec3i &v : faces_)
+    {
+        missing_uv |= v.iuv < 0;
+        missing_norm |= v.inorm < 0;
+    }
+    // 没有纹理坐标的顶点都用(0, 0)
+    if (missing_uv)
+    {
+        int uv = (int)textures_.size();
+        textures_.push_back(Vec3f(0, 0, 0));
+        for (Vec3i &v : faces_)
+        {
+            if (v.iuv < 0)
+                v.iuv = uv;
+        }
+    }
+    if (norms_x_.empty() || missing_norm)
+    {
+        compute_normals();
+    }
+    std::cerr << "# v# " << verts_.size() << " f# " << nfaces() << " vt# " << textures_.size() << " vn# " << norms_x_.size() << std::endl;
+}
+
+/**
+ * @brief 文件里没有vn或者有面缺少法线下标时计算顶点法线: 面法线(叉乘不归一化, 长度正比于面积)累加到三个顶点上再归一化
+ * 每个线程累加到自己的缓冲区, 最后按顶点分段合并, 不需要原子操作
+ * 计算后面的法线下标与顶点下标相同
+ */
+void Model::compute_normals()
+{
+    int nv = nverts();
+    int nf = nfaces();
+    int nthreads = std::max(1, std::min(worker_count(), nf / 1024));
+    std::vector<std::vector<float> > partial(nthreads, std::vector<float>(3 * nv, 0.f));
+    parallel_for(0, nthreads, [&](int begin, int end, int) {
+        for (int t = begin; t < end; ++t)
+        {
+            float *acc = partial[t].data();
+            int fbegin = (int)((long long)nf * t / nthreads);
+            int fend = (int)((long long)nf * (t + 1) / nthreads);
+            for (int i = fbegin; i < fend; ++i)
+            {
+                const Vec3i *f = &faces_[3 * i];
+                Vec3f v0 = verts_[f[0].ivert];
+                Vec3f n = (verts_[f[1].ivert] - v0) ^ (verts_[f[2].ivert] - v0);
+                for (int j = 0; j < 3; ++j)
+                {
+                    acc[3 * f[j].ivert + 0] += n.x;
+                    acc[3 * f[j].ivert + 1] += n.y;
+                    acc[3 * f[j].ivert + 2] += n.z;
+                }
+            }
+        }
+    }, 1);
+    norms_x_.assign(nv, 0.f);
+    norms_y_.assign(nv, 0.f);
+    norms_z_.assign(nv, 0.f);
+    parallel_for(0, nv, [&](int begin, int end, int) {
+        for (int v = begin; v < end; ++v)
+        {
+            Vec3f n;
+            for (int t = 0; t < nthreads; ++t)
+            {
+                n = n + Vec3f(partial[t][3 * v], partial[t][3 * v + 1], partial[t][3 * v + 2]);
+            }
+            float l = n.norm();
+            if (l > 0)
+            {
+                n = n * (1.f / l);
+            }
+            norms_x_[v] = n.x;
+            norms_y_[v] = n.y;
+            norms_z_[v] = n.z;
+        }
+    });
+    for (auto &v : faces_)
+    {
+        v.inorm = v.ivert;
+    }
 }
 
 Model::~Model()
@@ -80,7 +199,7 @@ int Model::nverts()
  */
 int Model::nfaces()
 {
-    return (int)faces_.size();
+    return (int)faces_.size() / 3;
 }
 
 int Model::ntextures()
@@ -88,15 +207,20 @@ int Model::ntextures()
     return (int)textures_.size();
 }
 
+int Model::nnorms()
+{
+    return (int)norms_x_.size();
+}
+
 /**
  * @brief 返回idx对应的面
  *
  * @param idx
- * @return std::vector<int>
+ * @return const Vec3i* 三个顶点的 (顶点, 纹理, 法线) 下标, 不拷贝
  */
-std::vector<Vec2i> Model::face(int idx)
+const Vec3i *Model::face(int idx)
 {
-    return faces_[idx];
+    return &faces_[3 * idx];
 }
 
 /**
@@ -110,7 +234,103 @@ Vec3f Model::vert(int i)
     return verts_[i];
 }
 
+/**
+ * @brief 返回第iface个面的第nthvert个顶点, 不用拷贝整个面
+ */
+Vec3f Model::vert(int iface, int nthvert)
+{
+    return verts_[faces_[3 * iface + nthvert].ivert];
+}
+
 Vec3f Model::texture(int i)
 {
     return textures_[i];
+}
+
+Vec3f Model::texture(int iface, int nthvert)
+{
+    return textures_[faces_[3 * iface + nthvert].iuv];
+}
+
+/**
+ * @brief 返回i对应的法线(已归一化)
+ *
+ * @param i
+ * @return Vec3f
+ */
+Vec3f Model::norm(int i)
+{
+    return Vec3f(norms_x_[i], norms_y_[i], norms_z_[i]);
+}
+
+Vec3f Model::norm(int iface, int nthvert)
+{
+    return norm(faces_[3 * iface + nthvert].inorm);
+}
+
+/**
+ * @brief 每次把每个三角形按边的中点分成4个, 用来生成面数很多的测试模型
+ * 共享边的中点只生成一次, 纹理坐标取平均, 法线取平均后归一化
+ *
+ * @param levels 细分次数, 面数变为原来的4^levels倍
+ */
+void Model::subdivide(int levels)
+{
+    for (int level = 0; level < levels; ++level)
+    {
+        std::unordered_map<unsigned long long, int> vert_mid, uv_mid, norm_mid;
+        auto key = [](int a, int b) {
+            return a < b ? ((unsigned long long)a << 32) | (unsigned)b : ((unsigned long long)b << 32) | (unsigned)a;
+        };
+        std::vector<Vec3i> faces;
+        faces.reserve(faces_.size() * 4);
+        for (size_t i = 0; i < faces_.size(); i += 3)
+        {
+            Vec3i mid[3];
+            for (int j = 0; j < 3; ++j)
+            {
+                const Vec3i &a = faces_[i + j];
+                const Vec3i &b = faces_[i + (j + 1) % 3];
+                auto v = vert_mid.emplace(key(a.ivert, b.ivert), (int)verts_.size());
+                if (v.second)
+                    verts_.push_back((verts_[a.ivert] + verts_[b.ivert]) * .5f);
+                auto t = uv_mid.emplace(key(a.iuv, b.iuv), (int)textures_.size());
+                if (t.second)
+                    textures_.push_back((textures_[a.iuv] + textures_[b.iuv]) * .5f);
+                auto n = norm_mid.emplace(key(a.inorm, b.inorm), (int)norms_x_.size());
+                if (n.second)
+                {
+                    Vec3f m = (norm(a.inorm) + norm(b.inorm)).normalize();
+                    norms_x_.push_back(m.x);
+                    norms_y_.push_back(m.y);
+                    norms_z_.push_back(m.z);
+                }
+                mid[j] = Vec3i(v.first->second, t.first->second, n.first->second);
+            }
+            // mid[0]在边01上, mid[1]在边12上, mid[2]在边20上, 保持原来的环绕方向
+            Vec3i c[3] = {faces_[i], faces_[i + 1], faces_[i + 2]};
+            Vec3i sub[12] = {c[0], mid[0], mid[2],
+                             mid[0], c[1], mid[1],
+                             mid[2], mid[1], c[2],
+                             mid[0], mid[1], mid[2]};
+            faces.insert(faces.end(), sub, sub + 12);
+        }
+        faces_.swap(faces);
+    }
+    std::cerr << "# subdivided: v# " << verts_.size() << " f# " << nfaces() << std::endl;
+}
+
+const float *Model::norms_x() const
+{
+    return norms_x_.data();
+}
+
+const float *Model::norms_y() const
+{
+    return norms_y_.data();
+}
+
+const float *Model::norms_z() const
+{
+    return norms_z_.data();
 }
\ No newline at end of file
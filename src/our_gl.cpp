@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cmath>
+#include "our_gl.h"
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// 向下取整的整数除法, b > 0
+static long long floor_div(long long a, long long b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+bool TriangleSetup::bounds(const Vec3f *pts, int x0, int y0, int x1, int y1)
+{
+    const long long one = 1LL << SUBPIXEL_BITS;
+    // 坐标限制在2^20像素以内, 边函数的乘积不会超出64位; 也丢掉了NaN
+    const float limit = (float)(1 << 20);
+    long long *X = X_, *Y = Y_;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!(std::abs(pts[i].x) < limit && std::abs(pts[i].y) < limit))
+        {
+            return false;
+        }
+        X[i] = std::llround(pts[i].x * one);
+        Y[i] = std::llround(pts[i].y * one);
+        v[i] = Vec3f(X[i] / (float)one, Y[i] / (float)one, pts[i].z);
+    }
+    area_ = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+    if (area_ <= 0)
+    {
+        return false;
+    }
+    float fxmin = std::min(v[0].x, std::min(v[1].x, v[2].x));
+    float fymin = std::min(v[0].y, std::min(v[1].y, v[2].y));
+    float fxmax = std::max(v[0].x, std::max(v[1].x, v[2].x));
+    float fymax = std::max(v[0].y, std::max(v[1].y, v[2].y));
+    xmin = std::max(x0, (int)std::ceil(fxmin));
+    ymin = std::max(y0, (int)std::ceil(fymin));
+    xmax = std::min(x1, (int)std::floor(fxmax));
+    ymax = std::min(y1, (int)std::floor(fymax));
+    ox = (int)std::floor(fxmin);
+    oy = (int)std::floor(fymin);
+    return xmin <= xmax && ymin <= ymax;
+}
+
+bool TriangleSetup::setup(const Vec3f *pts, int x0, int y0, int x1, int y1)
+{
+    if (!bounds(pts, x0, y0, x1, y1))
+    {
+        return false;
+    }
+    const long long one = 1LL << SUBPIXEL_BITS;
+    const long long *X = X_, *Y = Y_;
+    for (int k = 0; k < 3; ++k)
+    {
+        // 第k条边从顶点a到顶点b, 在它左侧(y轴向上时的逆时针方向)为正
+        int a = (k + 1) % 3, b = (k + 2) % 3;
+        long long ex = X[b] - X[a], ey = Y[b] - Y[a];
+        // top-left规则: 落在左边或上边上的像素算在三角形里, 落在其他边上的不算
+        bool top_left = ey < 0 || (ey == 0 && ex < 0);
+        c_[k] = ey * X[a] - ex * Y[a] - (top_left ? 0 : 1);
+        step_x_[k] = -ey * one;
+        step_y_[k] = ex * one;
+    }
+
+    const Vec3f &a = v[0], &b = v[1], &c = v[2];
+    // l0对应顶点a的重心坐标乘以面积, l1对应b, l2对应c
+    l_dx_[0] = b.y - c.y, l_dy_[0] = c.x - b.x;
+    l_dx_[1] = c.y - a.y, l_dy_[1] = a.x - c.x;
+    l_dx_[2] = a.y - b.y, l_dy_[2] = b.x - a.x;
+    l_[0] = (c.x - b.x) * (oy - b.y) - (c.y - b.y) * (ox - b.x);
+    l_[1] = (a.x - c.x) * (oy - c.y) - (a.y - c.y) * (ox - c.x);
+    l_[2] = (b.x - a.x) * (oy - a.y) - (b.y - a.y) * (ox - a.x);
+    inv_area_ = (float)((double)(one * one) / area_);
+    return true;
+}
+
+bool TriangleSetup::span(int y, int &x0, int &x1) const
+{
+    long long lo = xmin, hi = xmax;
+    for (int k = 0; k < 3; ++k)
+    {
+        // 这一行上 e + x * step_x_[k] >= 0
+        long long e = c_[k] + y * step_y_[k];
+        if (step_x_[k] > 0)
+        {
+            lo = std::max(lo, -floor_div(e, step_x_[k]));
+        }
+        else if (step_x_[k] < 0)
+        {
+            hi = std::min(hi, floor_div(e, -step_x_[k]));
+        }
+        else if (e < 0)
+        {
+            return false;
+        }
+    }
+    if (lo > hi)
+    {
+        return false;
+    }
+    x0 = (int)lo;
+    x1 = (int)hi;
+    return true;
+}
+
+void depth_triangle(const Vec3f *pts, float *zbuffer, int width, int height, bool cull_back)
+{
+    TriangleSetup tri;
+    if (!tri.setup(pts, 0, 0, width - 1, height - 1))
+    {
+        if (cull_back)
+        {
+            return;
+        }
+        // 不剔除背面时把顺时针的三角形换成逆时针再试一次
+        Vec3f swapped[3] = {pts[0], pts[2], pts[1]};
+        if (!tri.setup(swapped, 0, 0, width - 1, height - 1))
+        {
+            return;
+        }
+    }
+    // 和triangle()用同一个平面方程, z-prepass写入的深度和着色时算出的逐位相同
+    const TriangleSetup::Plane z_plane = tri.plane(tri.v[0].z, tri.v[1].z, tri.v[2].z);
+    for (int y = tri.ymin; y <= tri.ymax; ++y)
+    {
+        int xl, xr;
+        if (!tri.span(y, xl, xr))
+        {
+            continue;
+        }
+        const float z_row = z_plane.v0 + (y - tri.oy) * z_plane.dy;
+        float *row = zbuffer + y * width;
+        int x = xl;
+#ifdef __SSE__
+        // 4个像素一组: 用掩码混合新旧深度, 没有分支
+        const __m128 vz_row = _mm_set1_ps(z_row), vz_dx = _mm_set1_ps(z_plane.dx);
+        const __m128 four = _mm_set1_ps(4);
+        const float d0 = (float)(x - tri.ox);
+        __m128 dx = _mm_set_ps(d0 + 3, d0 + 2, d0 + 1, d0);
+        for (; x + 4 <= xr + 1; x += 4)
+        {
+            __m128 z = _mm_add_ps(vz_row, _mm_mul_ps(dx, vz_dx));
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 mask = _mm_cmpgt_ps(z, old);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, old)));
+            dx = _mm_add_ps(dx, four);
+        }
+#endif
+        for (; x <= xr; ++x)
+        {
+            float z = z_row + (float)(x - tri.ox) * z_plane.dx;
+            row[x] = z > row[x] ? z : row[x];
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include "parallel.h"
+
+int worker_count()
+{
+    static int count = []() {
+        const char *env = std::getenv("TINYRENDERER_THREADS");
+        int n = env ? std::atoi(env) : (int)std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }();
+    return count;
+}
+
+ThreadPool::ThreadPool(int nthreads) : fn_(NULL), ctx_(NULL), ntasks_(0), next_(0), active_(0), generation_(0), stop_(false)
+{
+    for (int i = 1; i < nthreads; ++i)
+    {
+        workers_.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &t : workers_)
+    {
+        t.join();
+    }
+}
+
+/**
+ * @brief 线程总数, 包括调用run()的线程
+ */
+int ThreadPool::size() const
+{
+    return (int)workers_.size() + 1;
+}
+
+void ThreadPool::work()
+{
+    for (int t = next_.fetch_add(1); t < ntasks_; t = next_.fetch_add(1))
+    {
+        fn_(ctx_, t);
+    }
+}
+
+void ThreadPool::worker_loop()
+{
+    unsigned long seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_)
+                return;
+            seen = generation_;
+        }
+        work();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--active_ == 0)
+                done_.notify_one();
+        }
+    }
+}
+
+/**
+ * @brief 执行 fn(ctx, t), t取遍[0, ntasks), 调用线程也参与, 全部完成后返回
+ */
+void ThreadPool::run(int ntasks, void (*fn)(void *, int), void *ctx)
+{
+    std::unique_lock<std::mutex> run_lock(run_mutex_, std::try_to_lock);
+    if (!run_lock.owns_lock() || workers_.empty())
+    {
+        for (int t = 0; t < ntasks; ++t)
+            fn(ctx, t);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fn_ = fn;
+        ctx_ = ctx;
+        ntasks_ = ntasks;
+        next_ = 0;
+        active_ = (int)workers_.size();
+        generation_++;
+    }
+    wake_.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&] { return active_ == 0; });
+}
+
+ThreadPool &ThreadPool::instance()
+{
+    static ThreadPool pool(worker_count());
+    return pool;
+}
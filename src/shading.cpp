@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cmath>
+#include "shading.h"
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// 法线长度平方的下限, 避免rsqrt(0)在牛顿迭代里变成NaN
+static const float min_length2 = 1e-30f;
+
+#ifdef __SSE__
+/**
+ * @brief rsqrtps 只有12位精度, 再做一次牛顿迭代 r = r * (1.5 - 0.5 * x * r * r)
+ */
+static inline __m128 rsqrt_nr(__m128 x)
+{
+    __m128 r = _mm_rsqrt_ps(x);
+    __m128 half_x = _mm_mul_ps(_mm_set1_ps(0.5f), x);
+    __m128 rr = _mm_mul_ps(r, r);
+    return _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(half_x, rr)));
+}
+#endif
+
+/**
+ * @brief 逐像素光照, 一次处理一整段像素, 避免每个像素单独 normalize (sqrt + 除法)
+ *
+ * @param nx, ny, nz 插值后(未归一化)的法线
+ * @param light 指向光源的单位向量
+ * @param out 光照强度, 背光处为0
+ * @param n 像素个数
+ * 长度为0的法线(compute_normals里可能出现)按光照为0处理, SSE和标量两条路径结果一致
+ */
+void lambert_batch(const float *nx, const float *ny, const float *nz, const Vec3f &light, float *out, int n)
+{
+    int k = 0;
+#ifdef __SSE__
+    const __m128 lx = _mm_set1_ps(light.x);
+    const __m128 ly = _mm_set1_ps(light.y);
+    const __m128 lz = _mm_set1_ps(light.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 eps = _mm_set1_ps(min_length2);
+    for (; k + 4 <= n; k += 4)
+    {
+        __m128 x = _mm_loadu_ps(nx + k);
+        __m128 y = _mm_loadu_ps(ny + k);
+        __m128 z = _mm_loadu_ps(nz + k);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, lx), _mm_mul_ps(y, ly)), _mm_mul_ps(z, lz));
+        __m128 l2 = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)), eps);
+        // maxps在有NaN时返回第二个操作数, NaN放在前面, 结果为0
+        _mm_storeu_ps(out + k, _mm_max_ps(_mm_mul_ps(d, rsqrt_nr(l2)), zero));
+    }
+#endif
+    for (; k < n; ++k)
+    {
+        float d = nx[k] * light.x + ny[k] * light.y + nz[k] * light.z;
+        float l2 = std::max(nx[k] * nx[k] + ny[k] * ny[k] + nz[k] * nz[k], min_length2);
+        float i = d / std::sqrt(l2);
+        out[k] = i > 0 ? i : 0;
+    }
+}
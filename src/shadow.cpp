@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "shadow.h"
+#include "our_gl.h"
+#include "arena.h"
+
+ShadowMap::ShadowMap(int size) : size_(size), depth_(NULL), x0_(0), y0_(0), scale_(1)
+{
+    depth_ = (float *)buffer_pool().acquire(sizeof(float) * size_ * size_);
+    std::fill(depth_, depth_ + size_ * size_, -FLT_MAX);
+}
+
+ShadowMap::~ShadowMap()
+{
+    buffer_pool().release(depth_);
+}
+
+/**
+ * @brief 从光源方向渲染模型的深度, 投影范围自动适配模型在光源坐标系下的包围盒
+ * 不做背面剔除, 否则开口的模型(比如脖子的截面)会漏光
+ *
+ * @param light_dir 光线传播的方向
+ */
+void ShadowMap::render(Model *model, Vec3f light_dir)
+{
+    ez_ = (light_dir * -1).normalize();
+    Vec3f up = std::abs(ez_.y) > 0.99f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+    ex_ = (up ^ ez_).normalize();
+    ey_ = ez_ ^ ex_;
+    float xmin = FLT_MAX, ymin = FLT_MAX, xmax = -FLT_MAX, ymax = -FLT_MAX;
+    for (int i = 0; i < model->nverts(); ++i)
+    {
+        Vec3f v = model->vert(i);
+        xmin = std::min(xmin, v * ex_);
+        xmax = std::max(xmax, v * ex_);
+        ymin = std::min(ymin, v * ey_);
+        ymax = std::max(ymax, v * ey_);
+    }
+    // 四周各留一个texel
+    scale_ = (size_ - 3) / std::max(std::max(xmax - xmin, ymax - ymin), 1e-6f);
+    x0_ = xmin - 1 / scale_;
+    y0_ = ymin - 1 / scale_;
+    std::fill(depth_, depth_ + size_ * size_, -FLT_MAX);
+    draw_depth(model, [this](Vec3f v) { return project(v); }, depth_, size_, size_, false);
+}
+
+/**
+ * @brief 模型空间的点变换到shadow map的像素坐标, z是朝向光源的深度(越大越近)
+ */
+Vec3f ShadowMap::project(const Vec3f &p) const
+{
+    return Vec3f((p * ex_ - x0_) * scale_, (p * ey_ - y0_) * scale_, p * ez_);
+}
+
+/**
+ * @brief PCF: 统计点p周围(2*radius+1)^2个texel里有多少没有被遮挡
+ *
+ * @param bias 深度偏移, 防止自遮挡产生条纹
+ * @return float 被照亮的比例, 0为完全在阴影里
+ */
+float ShadowMap::lit(const Vec3f &p, int radius, float bias) const
+{
+    Vec3f q = project(p);
+    int cx = (int)(q.x + .5f), cy = (int)(q.y + .5f);
+    float z = q.z + bias;
+    int count = 0;
+    for (int y = cy - radius; y <= cy + radius; ++y)
+    {
+        int yy = std::min(std::max(y, 0), size_ - 1);
+        const float *row = depth_ + yy * size_;
+        for (int x = cx - radius; x <= cx + radius; ++x)
+        {
+            int xx = std::min(std::max(x, 0), size_ - 1);
+            count += z >= row[xx];
+        }
+    }
+    return count / (float)((2 * radius + 1) * (2 * radius + 1));
+}
+
+int ShadowMap::size() const
+{
+    return size_;
+}
+
+const float *ShadowMap::depth() const
+{
+    return depth_;
+}
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+#include "ssao.h"
+#include "arena.h"
+#include "parallel.h"
+#include "timer.h"
+
+/**
+ * @brief 对一个tile里的像素计算遮蔽: 沿若干方向找深度缓冲上的最大仰角, 遮蔽取仰角正弦的平均
+ * 方向按像素位置在4x4的图案里旋转, 用少量方向也不会有明显的条纹, 噪声交给之后的模糊
+ */
+static void ssao_tile(const float *zbuffer, int width, int height, const SSAOParams &params,
+                      const float *dir_x, const float *dir_y, int x0, int y0, int x1, int y1, float *ao)
+{
+    const float step_len = params.radius / params.steps;
+    for (int y = y0; y < y1; ++y)
+    {
+        for (int x = x0; x < x1; ++x)
+        {
+            float z = zbuffer[y * width + x];
+            if (z <= params.background)
+            {
+                ao[y * width + x] = 1;
+                continue;
+            }
+            int pattern = ((y & 3) << 2) | (x & 3);
+            float occlusion = 0;
+            for (int s = 0; s < params.samples; ++s)
+            {
+                float dx = dir_x[pattern * params.samples + s];
+                float dy = dir_y[pattern * params.samples + s];
+                float max_slope = 0;
+                for (int k = 1; k <= params.steps; ++k)
+                {
+                    float dist = k * step_len;
+                    int sx = x + (int)(dx * dist);
+                    int sy = y + (int)(dy * dist);
+                    if (sx < 0 || sy < 0 || sx >= width || sy >= height)
+                        break;
+                    float slope = (zbuffer[sy * width + sx] - z) * params.depth_scale / dist;
+                    max_slope = std::max(max_slope, slope);
+                }
+                // 仰角的正弦, 比atan便宜
+                occlusion += max_slope / std::sqrt(1 + max_slope * max_slope);
+            }
+            ao[y * width + x] = 1 - occlusion / params.samples;
+        }
+    }
+}
+
+/**
+ * @brief 可分离的盒式模糊, 先横后竖, 按行并行; 中间结果放在frame_arena()里
+ */
+static void blur(float *ao, int width, int height, int radius)
+{
+    float *tmp = frame_arena().alloc<float>(width * height);
+    float norm = 1.f / (2 * radius + 1);
+    parallel_for(0, height, [&](int begin, int end, int) {
+        for (int y = begin; y < end; ++y)
+        {
+            const float *src = ao + y * width;
+            float *dst = tmp + y * width;
+            // 滑动窗口求和, 每个像素只加一个减一个
+            float sum = 0;
+            for (int k = -radius; k <= radius; ++k)
+            {
+                sum += src[std::min(std::max(k, 0), width - 1)];
+            }
+            for (int x = 0; x < width; ++x)
+            {
+                dst[x] = sum * norm;
+                sum += src[std::min(x + radius + 1, width - 1)] - src[std::max(x - radius, 0)];
+            }
+        }
+    }, 32);
+    // 竖直方向: 每次处理一整行, 读的也是整行, 对缓存友好
+    parallel_for(0, height, [&](int begin, int end, int) {
+        for (int y = begin; y < end; ++y)
+        {
+            float *dst = ao + y * width;
+            std::fill(dst, dst + width, 0.f);
+            for (int k = -radius; k <= radius; ++k)
+            {
+                const float *src = tmp + std::min(std::max(y + k, 0), height - 1) * width;
+                for (int x = 0; x < width; ++x)
+                {
+                    dst[x] += src[x];
+                }
+            }
+            for (int x = 0; x < width; ++x)
+            {
+                dst[x] *= norm;
+            }
+        }
+    }, 32);
+}
+
+/**
+ * @brief 屏幕空间环境光遮蔽, 图像分成tile多线程计算, 然后做可分离模糊
+ *
+ * @param zbuffer 最终的深度缓冲, z越大越近
+ * @param ao 输出, 大小为width*height
+ * @param timings 不为空时写入每个阶段的耗时
+ */
+void ssao(const float *zbuffer, int width, int height, const SSAOParams &params, float *ao, SSAOTimings *timings)
+{
+    Timer timer;
+    int samples = std::max(1, params.samples);
+    SSAOParams p = params;
+    p.samples = samples;
+    p.steps = std::max(1, params.steps);
+    float *dir_x = frame_arena().alloc<float>(16 * samples);
+    float *dir_y = frame_arena().alloc<float>(16 * samples);
+    for (int r = 0; r < 16; ++r)
+    {
+        for (int s = 0; s < samples; ++s)
+        {
+            float a = 6.2831853f * (s + r / 16.f) / samples;
+            dir_x[r * samples + s] = std::cos(a);
+            dir_y[r * samples + s] = std::sin(a);
+        }
+    }
+    int tile = std::max(8, params.tile);
+    int tiles_x = (width + tile - 1) / tile;
+    int tiles_y = (height + tile - 1) / tile;
+    parallel_for(0, tiles_x * tiles_y, [&](int begin, int end, int) {
+        for (int t = begin; t < end; ++t)
+        {
+            int x0 = (t % tiles_x) * tile, y0 = (t / tiles_x) * tile;
+            ssao_tile(zbuffer, width, height, p, dir_x, dir_y,
+                      x0, y0, std::min(x0 + tile, width), std::min(y0 + tile, height), ao);
+        }
+    }, 4);
+    if (timings)
+        timings->ao_ms = timer.elapsed_ms();
+    timer.reset();
+    if (params.blur_radius > 0)
+    {
+        blur(ao, width, height, params.blur_radius);
+    }
+    if (timings)
+        timings->blur_ms = timer.elapsed_ms();
+}
+
+void apply_ao(TGAImage &image, const float *ao, SSAOTimings *timings)
+{
+    Timer timer;
+    int width = image.get_width(), height = image.get_height(), bytespp = image.get_bytespp();
+    unsigned char *data = image.buffer();
+    int channels = std::min(bytespp, 3);
+    parallel_for(0, height, [&](int begin, int end, int) {
+        for (int i = begin * width; i < end * width; ++i)
+        {
+            for (int c = 0; c < channels; ++c)
+            {
+                data[i * bytespp + c] = (unsigned char)(data[i * bytespp + c] * ao[i]);
+            }
+        }
+    }, 32);
+    if (timings)
+        timings->apply_ms = timer.elapsed_ms();
+}
@@ -3,14 +3,16 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <algorithm>
 #include "tgaimage.h"
+#include "arena.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
 
 TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
 	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
+	data = (unsigned char *)buffer_pool().acquire(nbytes);
 	memset(data, 0, nbytes);
 }
 
@@ -19,29 +21,29 @@ TGAImage::TGAImage(const TGAImage &img) {
 	height = img.height;
 	bytespp = img.bytespp;
 	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
+	data = (unsigned char *)buffer_pool().acquire(nbytes);
 	memcpy(data, img.data, nbytes);
 }
 
 TGAImage::~TGAImage() {
-	if (data) delete [] data;
+	buffer_pool().release(data);
 }
 
 TGAImage & TGAImage::operator =(const TGAImage &img) {
 	if (this != &img) {
-		if (data) delete [] data;
+		buffer_pool().release(data);
 		width  = img.width;
 		height = img.height;
 		bytespp = img.bytespp;
 		unsigned long nbytes = width*height*bytespp;
-		data = new unsigned char[nbytes];
+		data = (unsigned char *)buffer_pool().acquire(nbytes);
 		memcpy(data, img.data, nbytes);
 	}
 	return *this;
 }
 
 bool TGAImage::read_tga_file(const char *filename) {
-	if (data) delete [] data;
+	buffer_pool().release(data);
 	data = NULL;
 	std::ifstream in;
 	in.open (filename, std::ios::binary);
@@ -66,7 +68,7 @@ bool TGAImage::read_tga_file(const char *filename) {
 		return false;
 	}
 	unsigned long nbytes = bytespp*width*height;
-	data = new unsigned char[nbytes];
+	data = (unsigned char *)buffer_pool().acquire(nbytes);
 	if (3==header.datatypecode || 2==header.datatypecode) {
 		in.read((char *)data, nbytes);
 		if (!in.good()) {
@@ -292,16 +294,13 @@ bool TGAImage::flip_horizontally() {
 bool TGAImage::flip_vertically() {
 	if (!data) return false;
 	unsigned long bytes_per_line = width*bytespp;
-	unsigned char *line = new unsigned char[bytes_per_line];
 	int half = height>>1;
+	// swap the lines in place, no temporary buffer needed
 	for (int j=0; j<half; j++) {
-		unsigned long l1 = j*bytes_per_line;
-		unsigned long l2 = (height-1-j)*bytes_per_line;
-		memmove((void *)line,      (void *)(data+l1), bytes_per_line);
-		memmove((void *)(data+l1), (void *)(data+l2), bytes_per_line);
-		memmove((void *)(data+l2), (void *)line,      bytes_per_line);
+		unsigned char *l1 = data+j*bytes_per_line;
+		unsigned char *l2 = data+(height-1-j)*bytes_per_line;
+		std::swap_ranges(l1, l1+bytes_per_line, l2);
 	}
-	delete [] line;
 	return true;
 }
 
@@ -315,7 +314,7 @@ void TGAImage::clear() {
 
 bool TGAImage::scale(int w, int h) {
 	if (w<=0 || h<=0 || !data) return false;
-	unsigned char *tdata = new unsigned char[w*h*bytespp];
+	unsigned char *tdata = (unsigned char *)buffer_pool().acquire(w*h*bytespp);
 	int nscanline = 0;
 	int oscanline = 0;
 	int erry = 0;
@@ -343,7 +342,7 @@ bool TGAImage::scale(int w, int h) {
 			nscanline += nlinebytes;
 		}
 	}
-	delete [] data;
+	buffer_pool().release(data);
 	data = tdata;
 	width = w;
 	height = h;
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cmath>
+#include "wireframe.h"
+#include "timer.h"
+
+/**
+ * @brief 取出模型里不重复的边: 每个面的三条边编码成(小下标, 大下标)排序后去重
+ *
+ * @param band 光栅化时每带的行数
+ */
+Wireframe::Wireframe(Model *model, int band) : band_(std::max(1, band))
+{
+    std::vector<unsigned long long> keys;
+    keys.reserve(3 * (size_t)model->nfaces());
+    for (int i = 0; i < model->nfaces(); ++i)
+    {
+        const Vec3i *f = model->face(i);
+        for (int j = 0; j < 3; ++j)
+        {
+            unsigned a = f[j].ivert, b = f[(j + 1) % 3].ivert;
+            if (a == b)
+                continue;
+            keys.push_back(a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    edges_.resize(2 * keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        edges_[2 * i] = (int)(keys[i] >> 32);
+        edges_[2 * i + 1] = (int)(keys[i] & 0xffffffffu);
+    }
+}
+
+int Wireframe::nedges() const
+{
+    return (int)edges_.size() / 2;
+}
+
+/**
+ * @brief Liang-Barsky: 把每条边裁剪到[0, width-1] x [0, height-1], 深度跟着参数t线性插值
+ * 屏幕空间的z对屏幕坐标是线性的, 所以插值不需要透视校正
+ */
+void Wireframe::clip(int width, int height)
+{
+    int n = nedges();
+    clipped_.resize(6 * (size_t)n);
+    rows_.resize(2 * (size_t)n);
+    parallel_for(0, n, [&](int begin, int end, int) {
+        for (int e = begin; e < end; ++e)
+        {
+            const Vec3f &a = screen_[edges_[2 * e]], &b = screen_[edges_[2 * e + 1]];
+            float dx = b.x - a.x, dy = b.y - a.y;
+            float t0 = 0, t1 = 1;
+            // 对每条边界 p * t <= q
+            auto clip_t = [&](float p, float q) {
+                if (p == 0)
+                    return q >= 0;
+                float r = q / p;
+                if (p < 0)
+                {
+                    if (r > t1)
+                        return false;
+                    t0 = std::max(t0, r);
+                }
+                else
+                {
+                    if (r < t0)
+                        return false;
+                    t1 = std::min(t1, r);
+                }
+                return true;
+            };
+            int *rows = &rows_[2 * e];
+            rows[0] = rows[1] = -1;
+            // 顶点坐标不是有限值(在相机平面上)时丢弃
+            if (!(std::isfinite(dx) && std::isfinite(dy)) ||
+                !clip_t(-dx, a.x) || !clip_t(dx, width - 1 - a.x) || !clip_t(-dy, a.y) || !clip_t(dy, height - 1 - a.y))
+                continue;
+            float *c = &clipped_[6 * e];
+            c[0] = a.x + t0 * dx;
+            c[1] = a.y + t0 * dy;
+            c[2] = a.z + t0 * (b.z - a.z);
+            c[3] = a.x + t1 * dx;
+            c[4] = a.y + t1 * dy;
+            c[5] = a.z + t1 * (b.z - a.z);
+            // 取整和外推可能多出半个像素, 行范围放宽一行, 光栅化时再逐像素判断
+            rows[0] = std::max(0, (int)(std::min(c[1], c[4]) - .5f));
+            rows[1] = std::min(height - 1, (int)(std::max(c[1], c[4]) + 1.5f));
+        }
+    });
+}
+
+/**
+ * @brief 按行分带, 每带里的边保持原来的顺序
+ */
+void Wireframe::bin(int height)
+{
+    int nbands = (height + band_ - 1) / band_;
+    int n = nedges();
+    offsets_.assign(nbands + 1, 0);
+    for (int e = 0; e < n; ++e)
+    {
+        if (rows_[2 * e] < 0)
+            continue;
+        for (int b = rows_[2 * e] / band_; b <= rows_[2 * e + 1] / band_; ++b)
+            offsets_[b + 1]++;
+    }
+    for (int b = 0; b < nbands; ++b)
+        offsets_[b + 1] += offsets_[b];
+    entries_.resize(offsets_[nbands]);
+    int *fill = entries_.data();
+    // offsets_[b]先当作写入位置用, 写完后等于下一带的起点, 最后整体右移一位
+    for (int e = 0; e < n; ++e)
+    {
+        if (rows_[2 * e] < 0)
+            continue;
+        for (int b = rows_[2 * e] / band_; b <= rows_[2 * e + 1] / band_; ++b)
+            fill[offsets_[b]++] = e;
+    }
+    for (int b = nbands; b > 0; --b)
+        offsets_[b] = offsets_[b - 1];
+    offsets_[0] = 0;
+}
+
+/**
+ * @brief 画出一带里的所有边, 只写这一带的行
+ * 沿主轴逐像素走, 另一个坐标和深度按公式直接算出(不累加), 不同的带对同一条边算出的像素相同
+ * 这里没有用SIMD: 一条线的像素分散在不同的行上, 每个像素还要单独做深度测试, 打包成向量后仍然要逐个写回,
+ * 而模型的边大多只有几个像素长. 并行来自分带, 各带在不同的线程上同时画
+ */
+void Wireframe::raster_band(int band, TGAImage &image, TGAColor color, const float *zbuffer, float zbias) const
+{
+    const int width = image.get_width(), height = image.get_height();
+    const int bpp = image.get_bytespp();
+    unsigned char *data = image.buffer();
+    const int r0 = band * band_, r1 = std::min(height, r0 + band_) - 1;
+    auto plot = [&](int x, int y, float z) {
+        if (zbuffer && z + zbias < zbuffer[y * width + x])
+            return;
+        unsigned char *p = data + ((size_t)y * width + x) * bpp;
+        for (int k = 0; k < bpp; ++k)
+            p[k] = color.raw[k];
+    };
+    for (int i = offsets_[band]; i < offsets_[band + 1]; ++i)
+    {
+        const float *c = &clipped_[6 * entries_[i]];
+        float x0 = c[0], y0 = c[1], z0 = c[2], x1 = c[3], y1 = c[4], z1 = c[5];
+        if (std::abs(x1 - x0) >= std::abs(y1 - y0))
+        {
+            if (x0 > x1)
+            {
+                std::swap(x0, x1);
+                std::swap(y0, y1);
+                std::swap(z0, z1);
+            }
+            float dx = x1 - x0;
+            float slope = dx > 0 ? (y1 - y0) / dx : 0, zslope = dx > 0 ? (z1 - z0) / dx : 0;
+            int xs = (int)(x0 + .5f), xe = (int)(x1 + .5f);
+            if (slope != 0)
+            {
+                // 只走y落在这一带里的那一段x
+                float xa = x0 + (r0 - .5f - y0) / slope, xb = x0 + (r1 + .5f - y0) / slope;
+                if (xa > xb)
+                    std::swap(xa, xb);
+                // 斜率很小时xa, xb可能非常大, 先限制在线段附近再取整
+                xa = std::max(xa, x0 - 1);
+                xb = std::min(xb, x1 + 1);
+                xs = std::max(xs, (int)std::floor(xa) - 1);
+                xe = std::min(xe, (int)std::floor(xb) + 1);
+            }
+            for (int x = xs; x <= xe; ++x)
+            {
+                int y = std::min(height - 1, (int)(y0 + (x - x0) * slope + .5f));
+                if (y < r0 || y > r1)
+                    continue;
+                plot(x, y, z0 + (x - x0) * zslope);
+            }
+        }
+        else
+        {
+            if (y0 > y1)
+            {
+                std::swap(x0, x1);
+                std::swap(y0, y1);
+                std::swap(z0, z1);
+            }
+            float dy = y1 - y0;
+            float slope = (x1 - x0) / dy, zslope = (z1 - z0) / dy;
+            int ys = std::max(r0, (int)(y0 + .5f)), ye = std::min(r1, (int)(y1 + .5f));
+            for (int y = ys; y <= ye; ++y)
+            {
+                int x = std::min(width - 1, (int)(x0 + (y - y0) * slope + .5f));
+                plot(x, y, z0 + (y - y0) * zslope);
+            }
+        }
+    }
+}
+
+/**
+ * @brief 画出所有边, 需要先用project()变换好顶点
+ *
+ * @param zbuffer 不为空时做深度测试(不写入), 被挡住的边不画; 为空时画出所有的边
+ * @param zbias 深度测试的容差, 边和它所在的面深度相同, 需要一个小的正数
+ */
+void Wireframe::draw(TGAImage &image, TGAColor color, const float *zbuffer, float zbias, Stats *stats)
+{
+    Timer timer;
+    clip(image.get_width(), image.get_height());
+    bin(image.get_height());
+    double clip_ms = timer.elapsed_ms();
+    timer.reset();
+    int nbands = (int)offsets_.size() - 1;
+    parallel_for(0, nbands, [&](int begin, int end, int) {
+        for (int b = begin; b < end; ++b)
+        {
+            raster_band(b, image, color, zbuffer, zbias);
+        }
+    }, 1);
+    if (stats)
+    {
+        stats->clip_ms = clip_ms;
+        stats->raster_ms = timer.elapsed_ms();
+        stats->visible = 0;
+        for (int e = 0; e < nedges(); ++e)
+        {
+            stats->visible += rows_[2 * e] >= 0;
+        }
+        stats->bin_entries = (long long)entries_.size();
+    }
+}
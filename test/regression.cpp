@@ -0,0 +1,415 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "tgaimage.h"
+
+/**
+ * 回归测试: 用固定的参数调用渲染程序, 结果和test/golden里的图逐像素比较,
+ * 再跑三遍--bench, 和test/baseline.txt里记录的时间比较
+ *
+ * 用法: regression <渲染程序> [--update] [--no-perf]
+ *   --update  用这次的结果覆盖golden图和baseline(确认画面的变化是预期的之后再用)
+ *   --no-perf 只比较图像
+ * 环境变量 TINYRENDERER_PERF_THRESHOLD 为允许变慢的比例, 默认0.2; 变慢超过它的一半时输出WARN, 不算失败
+ * 必须在仓库根目录运行, 渲染程序从当前目录读纹理
+ */
+
+const char *golden_dir = "test/golden";
+const char *out_dir = "test/out";
+const char *baseline_file = "test/baseline.txt";
+
+struct Case
+{
+    const char *name;
+    const char *args;
+    const char *golden;  // golden图的名字, 画面应该和另一种配置相同时共用一张
+    int tolerance;       // 每个通道允许的差
+    double max_bad;      // 超过容差的像素允许的比例
+    int hole_radius;     // 大于0时检查以图像中心为圆心, 这个半径内没有露出背景(黑色)的像素
+};
+
+// 模型的路径在运行时替换掉 {plane} {fan} {sphere} {sphere_no_normals}
+const Case cases[] = {
+    {"head_flat", "obj/african_head.obj --flat", "head_flat", 4, 0.001, 0},
+    {"head_gouraud", "obj/african_head.obj --gouraud", "head_gouraud", 4, 0.001, 0},
+    {"head_phong", "obj/african_head.obj --phong", "head_phong", 4, 0.001, 0},
+    {"head_tiled", "obj/african_head.obj --phong --tiled", "head_phong", 0, 0, 0},
+    {"head_zprepass", "obj/african_head.obj --phong --zprepass", "head_phong", 4, 0.001, 0},
+    {"head_shadow", "obj/african_head.obj --phong --shadow", "head_shadow", 4, 0.001, 0},
+    {"head_ssao", "obj/african_head.obj --phong --ssao", "head_ssao", 4, 0.001, 0},
+    {"head_subdivide", "obj/african_head.obj --subdivide 2 --phong", "head_subdivide", 4, 0.001, 0},
+    {"plane_gouraud", "{plane} --gouraud", "plane_gouraud", 4, 0.001, 0},
+    {"fan_flat", "{fan} --flat", "fan_flat", 4, 0.001, 200},
+    {"sphere_phong", "{sphere} --phong", "sphere_phong", 4, 0.001, 200},
+    {"sphere_tiled", "{sphere} --phong --tiled", "sphere_phong", 0, 0, 200},
+    {"sphere_no_normals", "{sphere_no_normals} --gouraud", "sphere_no_normals", 4, 0.001, 200},
+    {"head_wireframe", "obj/african_head.obj --phong --wireframe", "head_wireframe", 4, 0.001, 0},
+    {"plane_wireframe", "{plane} --gouraud --wireframe --xray", "plane_wireframe", 4, 0.001, 0},
+};
+
+/**
+ * @brief 斜着伸向远处的大平面, 只有两个三角形, 近处超出屏幕, 用来检查透视校正和裁剪
+ */
+void write_plane(const std::string &path)
+{
+    std::ofstream out(path);
+    out << "v -1 -1 1\nv 1 -1 1\nv 1 1 -4\nv -1 1 -4\n";
+    out << "vt 0 0 0\nvt 1 0 0\nvt 1 1 0\nvt 0 1 0\n";
+    float l = std::sqrt(5.f * 5.f + 2.f * 2.f);
+    out << "vn 0 " << 2 / l << " " << 5 / l << "\n";
+    out << "f 1/1/1 2/2/1 3/3/1\nf 1/1/1 3/3/1 4/4/1\n";
+}
+
+/**
+ * @brief 以屏幕中心为公共顶点的扇形, 很多细长的三角形, 用来检查共享边上没有缝隙
+ */
+void write_fan(const std::string &path, int n)
+{
+    std::ofstream out(path);
+    out << "v 0 0 0\nvt 0.5 0.5 0\nvn 0 0 1\n";
+    for (int i = 0; i < n; ++i)
+    {
+        float t = 2 * M_PI * i / n;
+        out << "v " << 0.9f * std::cos(t) << " " << 0.9f * std::sin(t) << " " << 0.3f * std::sin(3 * t) << "\n";
+        out << "vt " << 0.5f + 0.45f * std::cos(t) << " " << 0.5f + 0.45f * std::sin(t) << " 0\n";
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        int a = 2 + i, b = 2 + (i + 1) % n;
+        out << "f 1/1/1 " << a << "/" << a << "/1 " << b << "/" << b << "/1\n";
+    }
+}
+
+/**
+ * @brief 经纬度划分的球, 面数多且很小, 两极有退化的三角形, 同样检查共享边上没有缝隙
+ *
+ * @param normals 为false时不写vn, 面写成v/vt, 检查读入时计算法线
+ */
+void write_sphere(const std::string &path, int stacks, int slices, bool normals = true)
+{
+    std::ofstream out(path);
+    for (int i = 0; i <= stacks; ++i)
+    {
+        float theta = M_PI * i / stacks - M_PI / 2;
+        for (int j = 0; j <= slices; ++j)
+        {
+            float phi = 2 * M_PI * j / slices;
+            float x = std::cos(theta) * std::sin(phi), y = std::sin(theta), z = std::cos(theta) * std::cos(phi);
+            out << "v " << 0.8f * x << " " << 0.8f * y << " " << 0.8f * z << "\n";
+            out << "vt " << (float)j / slices << " " << (float)i / stacks << " 0\n";
+            if (normals)
+                out << "vn " << x << " " << y << " " << z << "\n";
+        }
+    }
+    for (int i = 0; i < stacks; ++i)
+    {
+        for (int j = 0; j < slices; ++j)
+        {
+            int a = i * (slices + 1) + j + 1, b = a + 1, c = a + slices + 2, d = a + slices + 1;
+            auto vertex = [&](int k) { return std::to_string(k) + "/" + std::to_string(k) + (normals ? "/" + std::to_string(k) : ""); };
+            out << "f " << vertex(a) << " " << vertex(b) << " " << vertex(c) << "\n";
+            out << "f " << vertex(a) << " " << vertex(c) << " " << vertex(d) << "\n";
+        }
+    }
+}
+
+/**
+ * @brief 以图像中心为圆心, 半径radius内纯黑(背景)像素的个数, 三角形之间的缝隙会露出背景
+ */
+int count_holes(TGAImage &image, int radius)
+{
+    int w = image.get_width(), h = image.get_height(), holes = 0;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            if ((x - w / 2) * (x - w / 2) + (y - h / 2) * (y - h / 2) >= radius * radius)
+                continue;
+            TGAColor c = image.get(x, y);
+            holes += c.raw[0] == 0 && c.raw[1] == 0 && c.raw[2] == 0;
+        }
+    }
+    return holes;
+}
+
+std::string replace_all(std::string s, const std::string &from, const std::string &to)
+{
+    for (size_t p = s.find(from); p != std::string::npos; p = s.find(from, p + to.size()))
+    {
+        s.replace(p, from.size(), to);
+    }
+    return s;
+}
+
+/**
+ * @brief 逐像素比较, 有差异时写出差异图: 超过容差的像素为红色, 其余按差的大小显示为灰度
+ *
+ * @return int 超过容差的像素个数, 尺寸不同时返回-1
+ */
+int compare(TGAImage &result, TGAImage &golden, int tolerance, const std::string &diff_path, int &max_diff)
+{
+    int w = result.get_width(), h = result.get_height();
+    max_diff = 0;
+    if (w != golden.get_width() || h != golden.get_height())
+    {
+        return -1;
+    }
+    TGAImage diff(w, h, TGAImage::RGB);
+    int bad = 0;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            TGAColor a = result.get(x, y), b = golden.get(x, y);
+            int d = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                d = std::max(d, std::abs((int)a.raw[k] - (int)b.raw[k]));
+            }
+            max_diff = std::max(max_diff, d);
+            if (d > tolerance)
+            {
+                bad++;
+                diff.set(x, y, TGAColor(255, 0, 0, 255));
+            }
+            else
+            {
+                unsigned char g = (unsigned char)std::min(255, d * 32);
+                diff.set(x, y, TGAColor(g, g, g, 255));
+            }
+        }
+    }
+    if (max_diff > 0)
+    {
+        diff.write_tga_file(diff_path.c_str());
+    }
+    return bad;
+}
+
+/**
+ * @brief 从--bench的输出里取出每一项的时间: "# bench <名字>: ... <数> ms/frame"
+ * 没有ms/frame的行取第一个以ms为单位的数
+ */
+std::map<std::string, double> parse_bench(const std::string &path)
+{
+    std::map<std::string, double> result;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.compare(0, 8, "# bench "))
+            continue;
+        size_t colon = line.find(": ");
+        if (colon == std::string::npos)
+            continue;
+        std::string name = line.substr(8, colon - 8);
+        std::string rest = line.substr(colon + 2);
+        size_t unit = rest.find(" ms/frame");
+        if (unit == std::string::npos)
+            unit = rest.find(" ms");
+        if (unit == std::string::npos)
+            continue;
+        size_t begin = rest.find_last_of(' ', unit - 1);
+        begin = begin == std::string::npos ? 0 : begin + 1;
+        result[name] = atof(rest.substr(begin, unit - begin).c_str());
+    }
+    return result;
+}
+
+/**
+ * @brief 从--bench的输出里取出稳态每帧的堆分配次数("... <数> heap allocs/frame"), 没有这一项时返回-1
+ */
+double parse_allocs(const std::string &path)
+{
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t unit = line.find(" heap allocs/frame");
+        if (unit == std::string::npos)
+            continue;
+        size_t begin = line.find_last_of(' ', unit - 1);
+        return atof(line.substr(begin + 1, unit - begin - 1).c_str());
+    }
+    return -1;
+}
+
+/**
+ * @brief 跑三次--bench, 每项取最快的一次, 减少偶然的抖动
+ */
+bool run_bench(const std::string &renderer, std::map<std::string, double> &times, double &allocs)
+{
+    allocs = 0;
+    for (int run = 0; run < 3; ++run)
+    {
+        std::string log = std::string(out_dir) + "/bench.log";
+        std::string cmd = renderer + " --bench -o " + out_dir + "/bench.tga 2> " + log;
+        if (std::system(cmd.c_str()) != 0)
+            return false;
+        double a = parse_allocs(log);
+        if (a < 0)
+            return false;
+        allocs = std::max(allocs, a);
+        for (auto &kv : parse_bench(log))
+        {
+            auto it = times.find(kv.first);
+            times[kv.first] = it == times.end() ? kv.second : std::min(it->second, kv.second);
+        }
+    }
+    return !times.empty();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <renderer> [--update] [--no-perf]" << std::endl;
+        return 2;
+    }
+    std::string renderer = argv[1];
+    bool update = false, perf = true;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--update"))
+            update = true;
+        else if (!strcmp(argv[i], "--no-perf"))
+            perf = false;
+    }
+    const char *env = getenv("TINYRENDERER_PERF_THRESHOLD");
+    double threshold = env ? atof(env) : 0.2;
+
+    std::filesystem::create_directories(out_dir);
+    std::string dir = out_dir;
+    write_plane(dir + "/plane.obj");
+    write_fan(dir + "/fan.obj", 4096);
+    write_sphere(dir + "/sphere.obj", 128, 256);
+    write_sphere(dir + "/sphere_no_normals.obj", 128, 256, false);
+
+    int failed = 0;
+    for (const Case &c : cases)
+    {
+        std::string args = replace_all(c.args, "{plane}", dir + "/plane.obj");
+        args = replace_all(args, "{fan}", dir + "/fan.obj");
+        args = replace_all(args, "{sphere_no_normals}", dir + "/sphere_no_normals.obj");
+        args = replace_all(args, "{sphere}", dir + "/sphere.obj");
+        std::string result_path = dir + "/" + c.name + ".tga";
+        std::string golden_path = std::string(golden_dir) + "/" + c.golden + ".tga";
+        std::string cmd = renderer + " " + args + " -o " + result_path + " 2> " + dir + "/" + c.name + ".log";
+        if (std::system(cmd.c_str()) != 0)
+        {
+            std::cout << "FAIL " << c.name << ": renderer exited with an error, see " << dir << "/" << c.name << ".log" << std::endl;
+            failed++;
+            continue;
+        }
+        TGAImage result, golden;
+        if (!result.read_tga_file(result_path.c_str()))
+        {
+            std::cout << "FAIL " << c.name << ": cannot read " << result_path << std::endl;
+            failed++;
+            continue;
+        }
+        if (c.hole_radius > 0)
+        {
+            int holes = count_holes(result, c.hole_radius);
+            std::cout << (holes ? "FAIL " : "ok   ") << c.name << ": " << holes << " background pixels within " << c.hole_radius
+                      << " px of the centre" << std::endl;
+            failed += holes != 0;
+        }
+        // 共用golden图的配置不覆盖golden
+        if (update && !strcmp(c.name, c.golden))
+        {
+            std::filesystem::copy_file(result_path, golden_path, std::filesystem::copy_options::overwrite_existing);
+            std::cout << "UPDATE " << golden_path << std::endl;
+            continue;
+        }
+        if (!golden.read_tga_file(golden_path.c_str()))
+        {
+            std::cout << "FAIL " << c.name << ": cannot read " << golden_path << std::endl;
+            failed++;
+            continue;
+        }
+        int max_diff;
+        std::string diff_path = dir + "/" + c.name + "_diff.tga";
+        int bad = compare(result, golden, c.tolerance, diff_path, max_diff);
+        int allowed = (int)(c.max_bad * result.get_width() * result.get_height());
+        bool ok = bad >= 0 && bad <= allowed;
+        std::cout << (ok ? "ok   " : "FAIL ") << c.name << ": ";
+        if (bad < 0)
+            std::cout << "size differs from " << golden_path;
+        else
+            std::cout << bad << " pixels over tolerance " << c.tolerance << " (allowed " << allowed << "), max diff " << max_diff;
+        if (max_diff > 0)
+            std::cout << ", diff " << diff_path;
+        std::cout << std::endl;
+        failed += !ok;
+    }
+
+    if (perf)
+    {
+        std::map<std::string, double> times;
+        double allocs;
+        if (!run_bench(renderer, times, allocs))
+        {
+            std::cout << "FAIL bench: no results, see " << dir << "/bench.log" << std::endl;
+            failed++;
+        }
+        else if (allocs != 0)
+        {
+            // 稳态下不应该有堆分配, 和机器无关, 不需要baseline, --update时也检查
+            std::cout << "FAIL bench steady-state heap allocs: " << allocs << " per frame" << std::endl;
+            failed++;
+        }
+        else if (update)
+        {
+            std::ofstream out(baseline_file);
+            for (auto &kv : times)
+            {
+                out << kv.second << " " << kv.first << "\n";
+            }
+            std::cout << "UPDATE " << baseline_file << std::endl;
+        }
+        else
+        {
+            std::cout << "ok   bench steady-state heap allocs: 0 per frame" << std::endl;
+            std::ifstream in(baseline_file);
+            std::string line;
+            while (std::getline(in, line))
+            {
+                std::istringstream iss(line);
+                double base;
+                std::string name;
+                if (!(iss >> base) || !std::getline(iss >> std::ws, name))
+                    continue;
+                auto it = times.find(name);
+                if (it == times.end())
+                {
+                    std::cout << "FAIL bench " << name << ": missing from --bench output" << std::endl;
+                    failed++;
+                    continue;
+                }
+                // 很短的项(几毫秒以下)受计时抖动影响大, 另外允许1ms的绝对误差
+                bool ok = it->second <= base * (1 + threshold) + 1;
+                bool warn = ok && it->second > base * (1 + threshold / 2) + 1;
+                std::cout << (!ok ? "FAIL " : warn ? "WARN " : "ok   ") << "bench " << name << ": " << it->second << " ms, baseline "
+                          << base << " ms (" << (it->second / base - 1) * 100 << "%)" << std::endl;
+                failed += !ok;
+            }
+        }
+    }
+
+    if (failed)
+    {
+        std::cout << failed << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}